@@ -0,0 +1,280 @@
+// Benchmarks of the public API against the simulator. Reports host time, modeled bus time and bus
+// traffic per operation, and checks the bus traffic and bus time against budgets.
+// Usage: stusb4500_bench [-b budgets] [-c bus clock Hz] [-o transaction overhead us]
+//                        [-n iterations]
+
+#include "stusb4500_sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_NAME 32
+
+typedef struct {
+    bool ok;
+    uint32_t transactions;
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t bytes_read;
+    uint32_t bytes_written;
+    uint64_t bus_time_us;
+    uint64_t elapsed_us;
+} result_t;
+
+typedef bool (*scenario_func_t)(stusb4500_sim_t* sim, stusb4500_t const* dev, result_t* result);
+
+typedef struct {
+    char const* name;
+    // Attach the cable after power up instead of at power up
+    bool attach_late;
+    scenario_func_t run;
+} scenario_t;
+
+static uint32_t bus_clock_hz = 100000UL;
+static uint32_t overhead_us = 0;
+
+static stusb4500_config_t const config = {
+  .min_current_ma = 1000,
+  .min_voltage_mv = 5000,
+  .max_voltage_mv = 20000,
+  .get_ms = stusb4500_sim_get_ms,
+};
+
+static stusb4500_nvm_config_t const nvm_config = {
+  .pdo1_current_ma = 1500,
+  .pdo2_voltage_mv = 9000,
+  .pdo2_current_ma = 2000,
+  .pdo3_voltage_mv = 12000,
+  .pdo3_current_ma = 1500,
+  .pdo_current_fallback = 1000,
+  .num_valid_pdos = 3,
+  .use_src_current = false,
+  .only_above_5v = true,
+  .gpio_cfg = STUSB4500_GPIO_CFG_SW_CTRL,
+};
+
+// Measure the traffic of the operations made in between. The simulator stats are cumulative
+static void begin(stusb4500_sim_t const* sim, result_t* result) {
+    result->transactions = sim->stats.transactions;
+    result->reads = sim->stats.reads;
+    result->writes = sim->stats.writes;
+    result->bytes_read = sim->stats.bytes_read;
+    result->bytes_written = sim->stats.bytes_written;
+    result->bus_time_us = sim->stats.bus_time_us;
+    result->elapsed_us = sim->now_us;
+}
+
+static void end(stusb4500_sim_t const* sim, result_t* result) {
+    result->transactions = sim->stats.transactions - result->transactions;
+    result->reads = sim->stats.reads - result->reads;
+    result->writes = sim->stats.writes - result->writes;
+    result->bytes_read = sim->stats.bytes_read - result->bytes_read;
+    result->bytes_written = sim->stats.bytes_written - result->bytes_written;
+    result->bus_time_us = sim->stats.bus_time_us - result->bus_time_us;
+    result->elapsed_us = sim->now_us - result->elapsed_us;
+}
+
+static bool negotiate(stusb4500_sim_t* sim, stusb4500_t const* dev, result_t* result) {
+    begin(sim, result);
+    result->ok = stusb4500_negotiate(dev, &config, false);
+    end(sim, result);
+    return result->ok;
+}
+
+static bool negotiate_interrupt(stusb4500_sim_t* sim, stusb4500_t const* dev, result_t* result) {
+    begin(sim, result);
+    stusb4500_sim_set_attached(sim, true);
+    result->ok = stusb4500_negotiate(dev, &config, true);
+    end(sim, result);
+    return result->ok;
+}
+
+static bool nvm_flash_noop(stusb4500_sim_t* sim, stusb4500_t const* dev, result_t* result) {
+    if (!stusb4500_nvm_flash(dev, &nvm_config)) return false;
+
+    begin(sim, result);
+    result->ok = stusb4500_nvm_flash(dev, &nvm_config);
+    end(sim, result);
+    return result->ok;
+}
+
+static bool nvm_flash(stusb4500_sim_t* sim, stusb4500_t const* dev, result_t* result) {
+    begin(sim, result);
+    result->ok = stusb4500_nvm_flash(dev, &nvm_config);
+    end(sim, result);
+    return result->ok;
+}
+
+static bool nvm_read(stusb4500_sim_t* sim, stusb4500_t const* dev, result_t* result) {
+    uint8_t nvm[STUSB4500_NVM_SIZE];
+
+    begin(sim, result);
+    result->ok = stusb4500_nvm_read(dev, nvm);
+    end(sim, result);
+    return result->ok;
+}
+
+static scenario_t const scenarios[] = {
+  {"negotiate", false, negotiate},
+  {"negotiate_interrupt", true, negotiate_interrupt},
+  {"nvm_flash_noop", false, nvm_flash_noop},
+  {"nvm_flash", false, nvm_flash},
+  {"nvm_read", false, nvm_read},
+};
+
+#define NUM_SCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+static bool run(scenario_t const* scenario, result_t* result) {
+    stusb4500_sim_config_t sim_config;
+    stusb4500_sim_t sim;
+    stusb4500_t dev;
+
+    stusb4500_sim_default_config(&sim_config);
+    sim_config.bus_clock_hz = bus_clock_hz;
+    sim_config.transaction_overhead_us = overhead_us;
+    sim_config.attached = !scenario->attach_late;
+
+    stusb4500_sim_init(&sim, &sim_config);
+    stusb4500_sim_bind(&sim, &dev);
+
+    return scenario->run(&sim, &dev, result);
+}
+
+// Budget lines: scenario name, maximum transactions, maximum bytes read and written, maximum
+// modeled bus time in ms
+static bool check_budgets(char const* path, result_t const* results) {
+    char line[128];
+    char name[MAX_NAME];
+    unsigned long transactions;
+    unsigned long bytes;
+    double bus_ms;
+    bool pass = true;
+    FILE* file = fopen(path, "r");
+
+    if (!file) {
+        perror(path);
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+
+        if (sscanf(line, "%31s %lu %lu %lf", name, &transactions, &bytes, &bus_ms) != 4) {
+            fprintf(stderr, "%s: malformed line: %s", path, line);
+            pass = false;
+            continue;
+        }
+
+        for (size_t i = 0; i < NUM_SCENARIOS; i++) {
+            result_t const* result = &results[i];
+            unsigned long const used_bytes = result->bytes_read + result->bytes_written;
+            uint64_t const bus_us = (uint64_t)(bus_ms * 1000.0 + 0.5);
+
+            if (strcmp(name, scenarios[i].name) != 0) continue;
+
+            if (result->transactions > transactions) {
+                printf(
+                  "%s: %lu transactions, budget %lu\n",
+                  name,
+                  (unsigned long)result->transactions,
+                  transactions);
+                pass = false;
+            }
+            if (used_bytes > bytes) {
+                printf("%s: %lu bytes, budget %lu\n", name, used_bytes, bytes);
+                pass = false;
+            }
+            if (result->bus_time_us > bus_us) {
+                printf(
+                  "%s: %.2f ms on the bus, budget %.2f ms\n",
+                  name,
+                  result->bus_time_us / 1000.0,
+                  bus_ms);
+                pass = false;
+            }
+        }
+    }
+
+    fclose(file);
+    return pass;
+}
+
+int main(int argc, char** argv) {
+    char const* budgets = NULL;
+    unsigned long iterations = 200;
+    result_t results[NUM_SCENARIOS];
+    bool pass = true;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-b") == 0) {
+            budgets = argv[i + 1];
+        } else if (strcmp(argv[i], "-c") == 0) {
+            bus_clock_hz = (uint32_t)strtoul(argv[i + 1], NULL, 0);
+        } else if (strcmp(argv[i], "-o") == 0) {
+            overhead_us = (uint32_t)strtoul(argv[i + 1], NULL, 0);
+        } else if (strcmp(argv[i], "-n") == 0) {
+            iterations = strtoul(argv[i + 1], NULL, 0);
+        } else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if (!iterations) iterations = 1;
+
+    printf(
+      "%lu Hz, %lu us per transaction, host time of %lu iterations including the bus model\n\n",
+      (unsigned long)bus_clock_hz,
+      (unsigned long)overhead_us,
+      iterations);
+    printf(
+      "%-20s %3s %9s %6s %6s %9s %9s %8s %8s %9s\n",
+      "scenario",
+      "ok",
+      "transact",
+      "reads",
+      "writes",
+      "bytes_rd",
+      "bytes_wr",
+      "bus_ms",
+      "total_ms",
+      "host_us");
+
+    for (size_t i = 0; i < NUM_SCENARIOS; i++) {
+        result_t* result = &results[i];
+        clock_t const start = clock();
+
+        for (unsigned long n = 0; n < iterations; n++) {
+            if (!run(&scenarios[i], result)) break;
+        }
+
+        double const host_us = (double)(clock() - start) * 1e6 / CLOCKS_PER_SEC / iterations;
+
+        printf(
+          "%-20s %3s %9lu %6lu %6lu %9lu %9lu %8.2f %8.2f %9.1f\n",
+          scenarios[i].name,
+          result->ok ? "yes" : "NO",
+          (unsigned long)result->transactions,
+          (unsigned long)result->reads,
+          (unsigned long)result->writes,
+          (unsigned long)result->bytes_read,
+          (unsigned long)result->bytes_written,
+          result->bus_time_us / 1000.0,
+          result->elapsed_us / 1000.0,
+          host_us);
+
+        pass = pass && result->ok;
+    }
+
+    if (budgets) {
+        printf("\n");
+        if (check_budgets(budgets, results)) {
+            printf("All budgets met\n");
+        } else {
+            pass = false;
+        }
+    }
+
+    return pass ? 0 : 1;
+}
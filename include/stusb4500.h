@@ -12,6 +12,100 @@ typedef bool (*stusb4500_write_t)(
   uint16_t addr, uint8_t reg, void const* buf, size_t len, void* context);
 typedef bool (*stusb4500_read_t)(uint16_t addr, uint8_t reg, void* buf, size_t len, void* context);
 typedef uint32_t (*stusb4500_get_ms_func_t)(void);
+// Block until the ALERT pin is asserted or the timeout expires. Returns true if ALERT is asserted
+typedef bool (*stusb4500_wait_alert_t)(uint32_t timeout_ms, void* context);
+// Sleep for at least the given number of microseconds
+typedef void (*stusb4500_delay_t)(uint32_t us, void* context);
+// Acquire or release exclusive use of a bus. Must allow the holder to acquire it again
+typedef void (*stusb4500_lock_t)(void* context);
+
+#ifdef STUSB4500_METRICS
+#define STUSB4500_METRICS_BUCKETS 12UL
+
+// Distribution of a measurement across calls
+typedef struct {
+    uint32_t count;
+    uint32_t last;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    // Bucket 0 counts values of 0, bucket n values from 2^(n-1) to 2^n - 1. The last bucket also
+    // counts all larger values
+    uint32_t histogram[STUSB4500_METRICS_BUCKETS];
+} stusb4500_stat_t;
+
+// Timed phases of stusb4500_negotiate() and stusb4500_nvm_flash()
+enum {
+    // Whole negotiation
+    STUSB4500_PHASE_NEGOTIATE,
+    // Presence and attach checks
+    STUSB4500_PHASE_ATTACH,
+    // Wait for PE_SNK_READY
+    STUSB4500_PHASE_WAIT_READY,
+    STUSB4500_PHASE_SOFT_RESET,
+    // Wait for and capture of the source capabilities
+    STUSB4500_PHASE_WAIT_CAPS,
+    // PDO search and contract check
+    STUSB4500_PHASE_SELECT_PDO,
+    // Sink PDO write, including a predicted PDO
+    STUSB4500_PHASE_LOAD_PDO,
+    // Whole flash
+    STUSB4500_PHASE_NVM_FLASH,
+    STUSB4500_PHASE_NVM_READ,
+    STUSB4500_PHASE_NVM_ERASE,
+    STUSB4500_PHASE_NVM_PROGRAM,
+    STUSB4500_PHASE_NVM_VERIFY,
+    STUSB4500_NUM_PHASES,
+};
+typedef uint8_t stusb4500_phase_t;
+
+// Status polling loops
+enum {
+    STUSB4500_WAIT_PE_READY,
+    STUSB4500_WAIT_MESSAGE,
+    STUSB4500_WAIT_FTP_IDLE,
+    STUSB4500_NUM_WAITS,
+};
+typedef uint8_t stusb4500_wait_t;
+
+typedef struct {
+    // Time base of the phase timings, phases are not timed if NULL
+    stusb4500_get_ms_func_t get_ms;
+
+    // Bus transactions, a combined transfer counts once
+    uint32_t transactions;
+    uint32_t failed_transactions;
+    // Register accesses
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t bytes_read;
+    uint32_t bytes_written;
+
+    // Elapsed ms per phase
+    stusb4500_stat_t phases[STUSB4500_NUM_PHASES];
+    // Status polls per wait loop
+    stusb4500_stat_t waits[STUSB4500_NUM_WAITS];
+} stusb4500_metrics_t;
+#endif // STUSB4500_METRICS
+
+enum {
+    STUSB4500_MSG_WRITE = 0UL,
+    STUSB4500_MSG_READ = 1UL,
+};
+typedef uint8_t stusb4500_msg_dir_t;
+
+// A register access within a combined transfer. buf is not modified by writes
+typedef struct {
+    uint8_t reg;
+    stusb4500_msg_dir_t dir;
+    void* buf;
+    size_t len;
+} stusb4500_msg_t;
+
+// Optional. Perform the messages in order as a single bus transaction, i.e. separated by
+// repeated starts with a single stop at the end
+typedef bool (*stusb4500_transfer_t)(
+  uint16_t addr, stusb4500_msg_t const* msgs, size_t num_msgs, void* context);
 
 typedef uint16_t stusb4500_current_t;
 typedef uint16_t stusb4500_voltage_t;
@@ -30,20 +124,207 @@ enum {
 };
 typedef uint8_t stusb4500_gpio_state_t;
 
+// ALERT_STATUS_1 bits
+enum {
+    STUSB4500_ALERT_PRT_STATUS = 0x02UL,
+    STUSB4500_ALERT_PD_TYPEC_STATUS = 0x08UL,
+    STUSB4500_ALERT_HW_FAULT_STATUS = 0x10UL,
+    STUSB4500_ALERT_MONITORING_STATUS = 0x20UL,
+    STUSB4500_ALERT_PORT_STATUS = 0x40UL,
+    STUSB4500_ALERT_HARD_RESET = 0x80UL,
+};
+typedef uint8_t stusb4500_alert_t;
+
+enum {
+    STUSB4500_NEGOTIATE_PENDING = 0UL,
+    STUSB4500_NEGOTIATE_DONE = 1UL,
+    STUSB4500_NEGOTIATE_ERROR = 2UL,
+    // Done without renegotiation, the active contract already uses the optimal PDO
+    STUSB4500_NEGOTIATE_SKIPPED = 3UL,
+    // Aborted, the cable was detached or the negotiation was cancelled
+    STUSB4500_NEGOTIATE_DETACHED = 4UL,
+};
+typedef uint8_t stusb4500_negotiate_status_t;
+
+// Maximum number of source power profiles, limited by the PD message header
+#define STUSB4500_MAX_SRC_PDOS 7UL
+#define STUSB4500_NUM_SNK_PDOS 3UL
+// 5 sectors, 8 bytes each
+#define STUSB4500_NVM_SIZE 40UL
+#define STUSB4500_NVM_SECTOR(n) (1UL << (n))
+#define STUSB4500_NVM_ALL_SECTORS 0x1FUL
+// Serialized NVM image: magic, version, NVM content and CRC-16, see stusb4500_nvm_image_pack()
+#define STUSB4500_NVM_IMAGE_SIZE (2UL + 1UL + STUSB4500_NVM_SIZE + 2UL)
+#define STUSB4500_NVM_IMAGE_MAGIC 0x4E53UL
+#define STUSB4500_NVM_IMAGE_VERSION 1UL
+// Default deadline of a status wait
+#define STUSB4500_TIMEOUT_MS 500UL
+// RX_BYTE_CNT, RX_HEADER and RX_DATA_OBJ registers
+#define STUSB4500_RX_CAPTURE_SIZE (3UL + STUSB4500_MAX_SRC_PDOS * sizeof(uint32_t))
+// PE_FSM state once a contract is established
+#define STUSB4500_PE_SNK_READY 0x18UL
+
 typedef struct {
     uint16_t addr;
     stusb4500_write_t write;
     stusb4500_read_t read;
     void* context;
+    // Optional, NULL to perform batched accesses with individual reads and writes
+    stusb4500_transfer_t transfer;
+    // Optional, NULL to poll registers while waiting. Requires stusb4500_alert_enable()
+    stusb4500_wait_alert_t wait_alert;
+    // Optional, NULL to poll status registers back to back. After a few fast polls, waits back off
+    // through it with growing delays
+    stusb4500_delay_t delay;
+    // Deadline of each FTP command of the NVM routines, STUSB4500_TIMEOUT_MS if 0
+    uint32_t ftp_timeout_ms;
+    // Optional, NULL if the bus is used by a single thread. Held around every bus transaction and
+    // every sequence of transactions which must not be interleaved with other accesses to the bus,
+    // but not while waiting in between. See stusb4500_session.h
+    stusb4500_lock_t lock;
+    stusb4500_lock_t unlock;
+    void* lock_context;
+#ifdef STUSB4500_METRICS
+    // Optional, NULL to not collect metrics
+    stusb4500_metrics_t* metrics;
+#endif // STUSB4500_METRICS
+#ifdef STUSB4500_TRACE
+    // Optional, NULL to not trace. See stusb4500_trace.h
+    struct stusb4500_trace* trace;
+#endif // STUSB4500_TRACE
 } stusb4500_t;
 
+enum {
+    STUSB4500_PDO_FIXED = 0UL,
+    STUSB4500_PDO_BATTERY = 1UL,
+    STUSB4500_PDO_VARIABLE = 2UL,
+    // Programmable power supply, requires USBPD_REV30_SUPPORT
+    STUSB4500_PDO_PPS = 3UL,
+};
+typedef uint8_t stusb4500_pdo_type_t;
+
+// Decoded source PDO. Fixed supplies have min_voltage_mv == max_voltage_mv
+typedef struct {
+    stusb4500_pdo_type_t type;
+    stusb4500_voltage_t min_voltage_mv;
+    stusb4500_voltage_t max_voltage_mv;
+    // 0 for batteries, which are limited by power instead
+    stusb4500_current_t max_current_ma;
+    uint32_t max_power_mw;
+} stusb4500_src_pdo_t;
+
+// Criteria of a PDO selection policy, evaluated at the candidate's operating point
+enum {
+    // Operating power (mW)
+    STUSB4500_SCORE_POWER = 0UL,
+    // Operating voltage (mV), use a negative weight to prefer low voltages
+    STUSB4500_SCORE_VOLTAGE = 1UL,
+    // Distance of the operating voltage from the target voltage (mV), use a negative weight
+    STUSB4500_SCORE_TARGET_VOLTAGE = 2UL,
+    // Current available above the minimum current (mA)
+    STUSB4500_SCORE_HEADROOM = 3UL,
+};
+typedef uint8_t stusb4500_score_t;
+
+typedef struct {
+    stusb4500_score_t criterion;
+    int16_t weight;
+} stusb4500_score_term_t;
+
+// A candidate's score is the weighted sum of the terms
+typedef struct {
+    stusb4500_score_term_t const* terms;
+    uint8_t num_terms;
+    // Operating voltage of variable, battery and PPS supplies, clamped to the supply's range. The
+    // highest voltage allowed is used if 0
+    stusb4500_voltage_t target_voltage_mv;
+} stusb4500_policy_t;
+
+// A source PDO which satisfies the configured constraints
+typedef struct {
+    stusb4500_src_pdo_t pdo;
+    // Object position in the source capabilities, starting at 1
+    uint8_t position;
+    // Operating point
+    stusb4500_voltage_t voltage_mv;
+    stusb4500_current_t current_ma;
+    uint32_t power_mw;
+    int64_t score;
+    // The STUSB4500 sink PDOs can only request fixed supplies
+    bool requestable;
+} stusb4500_candidate_t;
+
+typedef struct {
+    // Hash of the source capabilities and the selection constraints, 0 if unused
+    uint32_t fingerprint;
+    // Sink PDO chosen for that source
+    uint32_t snk_pdo;
+} stusb4500_pdo_cache_entry_t;
+
+// Recently seen sources, most recently used first. The entries are caller-provided storage and
+// must be zero-initialized before first use. They may be persisted and restored across reboots
+typedef struct {
+    stusb4500_pdo_cache_entry_t* entries;
+    uint8_t num_entries;
+} stusb4500_pdo_cache_t;
+
 typedef struct {
     stusb4500_current_t min_current_ma;
     stusb4500_voltage_t min_voltage_mv;
     stusb4500_voltage_t max_voltage_mv;
     stusb4500_get_ms_func_t get_ms;
+    // Optional, NULL to always search the source capabilities
+    stusb4500_pdo_cache_t* cache;
+    // Optional, NULL to select the highest power PDO
+    stusb4500_policy_t const* policy;
+    // Load fallback profiles into PDO1 and PDO2 along with the optimal PDO, see
+    // stusb4500_pdo_snk_set()
+    bool load_all_pdos;
+    // Deadline of each wait of a negotiation, STUSB4500_TIMEOUT_MS if 0
+    uint32_t timeout_ms;
 } stusb4500_config_t;
 
+// Bounded status wait with backoff. Treat as opaque
+typedef struct {
+    stusb4500_get_ms_func_t get_ms;
+    uint32_t start_ms;
+    uint32_t timeout_ms;
+    // Time spent polling and sleeping, the time base without get_ms
+    uint32_t elapsed_us;
+    uint32_t polls;
+    uint32_t delay_us;
+    uint32_t max_delay_us;
+} stusb4500_backoff_t;
+
+// State of a non-blocking negotiation. Treat as opaque, see stusb4500_negotiate_poll()
+typedef struct {
+    stusb4500_t const* dev;
+    stusb4500_config_t const* config;
+    bool on_interrupt;
+    bool pdo_loaded;
+    bool predicted;
+    bool cache_hit;
+    bool waiting;
+    uint8_t state;
+    uint8_t next_state;
+    uint16_t header;
+    stusb4500_backoff_t backoff;
+    uint32_t fingerprint;
+    uint32_t snk_pdo;
+    uint8_t num_snk_pdos;
+    uint32_t snk_pdos[STUSB4500_NUM_SNK_PDOS];
+    uint8_t buffer[STUSB4500_RX_CAPTURE_SIZE];
+    uint8_t num_src_pdos;
+    uint32_t src_pdos[STUSB4500_MAX_SRC_PDOS];
+    uint8_t num_candidates;
+    stusb4500_candidate_t candidates[STUSB4500_MAX_SRC_PDOS];
+    bool capture_locked;
+#ifdef STUSB4500_METRICS
+    uint32_t metrics_start;
+    uint32_t phase_start;
+#endif // STUSB4500_METRICS
+} stusb4500_negotiation_t;
+
 typedef struct {
     // PDO1 voltage fixed to 5V
     stusb4500_current_t pdo1_current_ma;
@@ -66,9 +347,139 @@ typedef struct {
     stusb4500_gpio_cfg_t gpio_cfg;
 } stusb4500_nvm_config_t;
 
+// Customer fields of the NVM, in raw units. See the STUSB4500 NVM description
+enum {
+    // GPIO configuration, see stusb4500_gpio_cfg_t
+    STUSB4500_NVM_GPIO_CFG,
+    // Disable the VBUS discharge path
+    STUSB4500_NVM_VBUS_DISCH_DISABLE,
+    // VBUS discharge time to 0V, 84 ms steps
+    STUSB4500_NVM_VBUS_DISCH_TIME_TO_0V,
+    // VBUS discharge time to a lower PDO voltage, 24 ms steps
+    STUSB4500_NVM_VBUS_DISCH_TIME_TO_PDO,
+    STUSB4500_NVM_USB_COMM_CAPABLE,
+    // Number of valid sink PDOs, 1 to 3
+    STUSB4500_NVM_SNK_PDO_NUMB,
+    // Unconstrained power, e.g. an external supply
+    STUSB4500_NVM_SNK_UNCONS_POWER,
+    // PDO currents, 0 for the flexible current, otherwise (value + 1) * 0.25 A
+    STUSB4500_NVM_I_SNK_PDO1,
+    STUSB4500_NVM_I_SNK_PDO2,
+    STUSB4500_NVM_I_SNK_PDO3,
+    // Voltage monitoring window of each PDO above (HL) and below (LL) its voltage, 1 % steps
+    STUSB4500_NVM_SHIFT_VBUS_HL1,
+    STUSB4500_NVM_SHIFT_VBUS_LL2,
+    STUSB4500_NVM_SHIFT_VBUS_HL2,
+    STUSB4500_NVM_SHIFT_VBUS_LL3,
+    STUSB4500_NVM_SHIFT_VBUS_HL3,
+    // PDO voltages, 50 mV steps. PDO1 is fixed to 5V
+    STUSB4500_NVM_V_SNK_PDO2,
+    STUSB4500_NVM_V_SNK_PDO3,
+    // Current of PDOs with a current of 0, 10 mA steps
+    STUSB4500_NVM_I_SNK_PDO_FLEX,
+    // POWER_OK pins configuration
+    STUSB4500_NVM_POWER_OK_CFG,
+    STUSB4500_NVM_POWER_ONLY_ABOVE_5V,
+    STUSB4500_NVM_REQ_SRC_CURRENT,
+    STUSB4500_NVM_NUM_FIELDS,
+};
+typedef uint8_t stusb4500_nvm_field_t;
+
 bool stusb4500_negotiate(
   stusb4500_t const* dev, stusb4500_config_t const* config, bool on_interrupt);
+// Non-blocking negotiation. dev and config must outlive the negotiation. Each call to
+// stusb4500_negotiate_poll() performs at most one bus transaction and returns
+// STUSB4500_NEGOTIATE_PENDING until the negotiation is done, skipped or has failed. Once the source
+// capabilities message has been detected, keep polling without delay until the PDOs are read. With
+// a lock on the device handle, the bus stays locked from the detection until then. Every status
+// wait also checks the attach state, so a detach ends the negotiation with
+// STUSB4500_NEGOTIATE_DETACHED at the next poll instead of at the deadline.
+void stusb4500_negotiate_start(
+  stusb4500_negotiation_t* ctx,
+  stusb4500_t const* dev,
+  stusb4500_config_t const* config,
+  bool on_interrupt);
+stusb4500_negotiate_status_t stusb4500_negotiate_poll(stusb4500_negotiation_t* ctx);
+// True if the last poll found the STUSB4500 busy. In ALERT mode, the next poll can wait for ALERT
+bool stusb4500_negotiate_is_waiting(stusb4500_negotiation_t const* ctx);
+// Microseconds to sleep before the next poll, 0 to poll right away. Grows while the STUSB4500 stays
+// busy, up to a limit which keeps the source capabilities capture in time
+uint32_t stusb4500_negotiate_delay_us(stusb4500_negotiation_t const* ctx);
+// Abort the negotiation without bus traffic, e.g. on a detach seen by the ALERT handler or a port
+// monitor. The next poll returns STUSB4500_NEGOTIATE_DETACHED. Call from the polling thread
+void stusb4500_negotiate_cancel(stusb4500_negotiation_t* ctx);
+// True from the soft reset which solicits the source capabilities until they are read. No bus
+// transaction has been made for the soft reset when this becomes true, so a caller serving several
+// devices may hold back the negotiation to keep the captures apart
+bool stusb4500_negotiate_is_capturing(stusb4500_negotiation_t const* ctx);
+// Source PDOs ranked by the last PDO search of the negotiation, best first. Empty if the choice
+// came from the cache
+stusb4500_candidate_t const*
+  stusb4500_negotiate_candidates(stusb4500_negotiation_t const* ctx, uint8_t* num_candidates);
+
+// Decode a source PDO. Returns false for unsupported PDO types
+bool stusb4500_pdo_decode(uint32_t pdo, stusb4500_src_pdo_t* decoded);
+// Rank source PDOs by the policy of the config, best first. PDOs violating the voltage and
+// current constraints of the config are left out. Returns the number of candidates
+uint8_t stusb4500_pdo_rank(
+  stusb4500_config_t const* config,
+  uint32_t const* src_pdos,
+  uint8_t num_pdos,
+  stusb4500_candidate_t* candidates,
+  uint8_t max_candidates);
+// Compute an ordered set of sink PDOs from source PDOs. PDO1 is 5V, the last PDO is the best
+// ranked fixed supply and PDO2, if any, is the best ranked fixed supply in between. snk_pdos must
+// hold STUSB4500_NUM_SNK_PDOS entries. Returns the number of sink PDOs, 0 if none is suitable
+uint8_t stusb4500_pdo_snk_set(
+  stusb4500_config_t const* config,
+  uint32_t const* src_pdos,
+  uint8_t num_pdos,
+  uint32_t* snk_pdos);
+// Load sink PDO1 to PDO3 and the number of active PDOs without flashing the NVM. Takes effect at
+// the next negotiation
+bool stusb4500_load_pdos(stusb4500_t const* dev, uint32_t const* snk_pdos, uint8_t num_pdos);
 bool stusb4500_set_gpio_state(stusb4500_t const* dev, stusb4500_gpio_state_t state);
 
+// Drive the ALERT pin from the given ALERT_STATUS_1 bits and clear pending alerts. Use
+// STUSB4500_ALERT_PRT_STATUS | STUSB4500_ALERT_PORT_STATUS for negotiation
+bool stusb4500_alert_enable(stusb4500_t const* dev, stusb4500_alert_t alerts);
+// Read and clear ALERT_STATUS_1
+bool stusb4500_alert_read(stusb4500_t const* dev, stusb4500_alert_t* alerts);
+
+#ifdef STUSB4500_METRICS
+// Clear all counters and statistics, the time base is kept
+void stusb4500_metrics_reset(stusb4500_metrics_t* metrics);
+#endif // STUSB4500_METRICS
+
 bool stusb4500_nvm_read(stusb4500_t const* dev, uint8_t* nvm);
+// Read the sectors selected by a mask of STUSB4500_NVM_SECTOR() into their place in the NVM image.
+// The other sectors of the image are left untouched
+bool stusb4500_nvm_read_sectors(stusb4500_t const* dev, uint8_t sectors, uint8_t* nvm);
+// Read a single field, only its sector is read
+bool stusb4500_nvm_read_field(
+  stusb4500_t const* dev, stusb4500_nvm_field_t field, uint16_t* value);
+// Compare fields of a device against a serialized golden image, reading only the sectors which
+// hold them. All fields are compared if fields is NULL. On return, mismatches has bit n set if
+// field n differs. Returns false if the NVM could not be read or the image is invalid
+bool stusb4500_nvm_audit(
+  stusb4500_t const* dev,
+  uint8_t const* image,
+  stusb4500_nvm_field_t const* fields,
+  size_t num_fields,
+  uint32_t* mismatches);
 bool stusb4500_nvm_flash(stusb4500_t const* dev, stusb4500_nvm_config_t const* config);
+
+// Field access on an NVM image. Set fails if the value does not fit the field
+bool stusb4500_nvm_get(uint8_t const* nvm, stusb4500_nvm_field_t field, uint16_t* value);
+bool stusb4500_nvm_set(uint8_t* nvm, stusb4500_nvm_field_t field, uint16_t value);
+// Mask of the sector holding a field, 0 for invalid fields
+uint8_t stusb4500_nvm_field_sectors(stusb4500_nvm_field_t field);
+// Apply a configuration to an NVM image, as done by stusb4500_nvm_flash()
+void stusb4500_nvm_apply_config(uint8_t* nvm, stusb4500_nvm_config_t const* config);
+// Serialize an NVM image into STUSB4500_NVM_IMAGE_SIZE bytes, e.g. a golden image read from a
+// reference unit. Unpacking fails if the magic, version or checksum do not match
+bool stusb4500_nvm_image_pack(uint8_t const* nvm, uint8_t* image);
+bool stusb4500_nvm_image_unpack(uint8_t const* image, uint8_t* nvm);
+// Erase and program all sectors with a serialized image without reading the NVM first. The NVM is
+// read back for verification only
+bool stusb4500_nvm_flash_image(stusb4500_t const* dev, uint8_t const* image);
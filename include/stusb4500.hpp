@@ -0,0 +1,634 @@
+#pragma once
+
+// Header-only C++17 layer over the STUSB4500. The driver logic is templated on a bus policy, so
+// register accesses are direct calls which the compiler can inline, instead of calls through the
+// function pointers of stusb4500_t. A bus policy addresses one STUSB4500 and provides:
+//
+//     bool read(uint8_t reg, void* buf, size_t len);
+//     bool write(uint8_t reg, void const* buf, size_t len);
+//     void delay_us(uint32_t us);
+//
+// and optionally, to perform several accesses as a single bus transaction like
+// stusb4500_t.transfer:
+//
+//     bool transfer(stusb4500_msg_t const* msgs, size_t num_msgs);
+//
+// With it, the FTP sequences take as few bus transactions as on the C path.
+//
+// Register addresses and NVM field layouts are constexpr, and FTP access is scoped by FtpSession,
+// which locks the NVM again on every path out of the scope.
+
+extern "C" {
+#include "stusb4500.h"
+#include "stusb4500_defs.h"
+#include "stusb4500_regs.h"
+}
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+namespace stusb4500 {
+
+namespace reg {
+
+inline constexpr uint8_t ALERT_STATUS_1 = STUSB4500_REG_ALERT_STATUS_1;
+inline constexpr uint8_t ALERT_STATUS_1_MASK = STUSB4500_REG_ALERT_STATUS_1_MASK;
+inline constexpr uint8_t PORT_STATUS_1 = STUSB4500_REG_PORT_STATUS_1;
+inline constexpr uint8_t PRT_STATUS = STUSB4500_REG_PRT_STATUS;
+inline constexpr uint8_t PD_COMMAND_CTRL = STUSB4500_REG_PD_COMMAND_CTRL;
+inline constexpr uint8_t PE_FSM = STUSB4500_REG_PE_FSM;
+inline constexpr uint8_t GPIO3_SW_GPIO = STUSB4500_REG_GPIO3_SW_GPIO;
+inline constexpr uint8_t DEVICE_ID = STUSB4500_REG_DEVICE_ID;
+inline constexpr uint8_t RX_BYTE_CNT = STUSB4500_REG_RX_BYTE_CNT;
+inline constexpr uint8_t RX_HEADER = STUSB4500_REG_RX_HEADER;
+inline constexpr uint8_t RX_DATA_OBJ = STUSB4500_REG_RX_DATA_OBJ;
+inline constexpr uint8_t TX_HEADER = STUSB4500_REG_TX_HEADER;
+inline constexpr uint8_t RW_BUFFER = STUSB4500_RW_BUFFER;
+inline constexpr uint8_t DPM_PDO_NUMB = STUSB4500_REG_DPM_PDO_NUMB;
+inline constexpr uint8_t DPM_SNK_PDO1 = STUSB4500_REG_DPM_SNK_PDO1;
+inline constexpr uint8_t RDO_STATUS = STUSB4500_REG_RDO_STATUS;
+inline constexpr uint8_t FTP_CUST_PASSWORD = STUSB4500_FTP_CUST_PASSWORD_REG;
+inline constexpr uint8_t FTP_CTRL_0 = STUSB4500_FTP_CTRL_0;
+inline constexpr uint8_t FTP_CTRL_1 = STUSB4500_FTP_CTRL_1;
+
+} // namespace reg
+
+// Location of an NVM field. Fields span at most two bytes, which are read as a little endian word
+struct NvmField {
+    uint8_t sector;
+    uint8_t offset;
+    uint8_t pos;
+    uint16_t msk;
+
+    constexpr uint8_t sectors() const {
+        return static_cast<uint8_t>(1U << sector);
+    }
+};
+
+using nvm_t = uint8_t[STUSB4500_NVM_SIZE];
+
+namespace detail {
+
+inline constexpr uint8_t ID_STUSB4500 = 0x25;
+inline constexpr uint8_t ID_STUSB4500B = 0x21;
+inline constexpr uint8_t ATTACH = 0x01;
+inline constexpr uint8_t PRT_MESSAGE_RECEIVED = 0x04;
+inline constexpr uint8_t SRC_CAPABILITIES_MSG = 0x01;
+
+// PD protocol commands, see USB PD spec Table 6-3
+inline constexpr uint8_t PD_CMD = 0x26;
+inline constexpr uint16_t PD_SOFT_RESET = 0x000D;
+
+// FTP controller, see stusb4500_defs.h
+inline constexpr uint8_t FTP_PASSWORD = STUSB4500_FTP_CUST_PASSWORD;
+inline constexpr uint8_t FTP_CUST_PWR = STUSB4500_FTP_CUST_PWR;
+inline constexpr uint8_t FTP_CUST_RST_N = STUSB4500_FTP_CUST_RST_N;
+inline constexpr uint8_t FTP_CUST_REQ = STUSB4500_FTP_CUST_REQ;
+inline constexpr uint8_t FTP_CUST_SECT = STUSB4500_FTP_CUST_SECT;
+inline constexpr uint8_t FTP_CUST_SER = STUSB4500_FTP_CUST_SER;
+inline constexpr uint8_t FTP_CUST_OPCODE = STUSB4500_FTP_CUST_OPCODE;
+inline constexpr uint8_t FTP_RESET = 0x00;
+inline constexpr uint8_t FTP_POWER_ON = FTP_CUST_PWR | FTP_CUST_RST_N;
+// Accesses ahead of an FTP command in its bus transaction
+inline constexpr size_t FTP_MAX_SETUP_MSGS = 2;
+
+enum FtpOpcode : uint8_t {
+    READ = STUSB4500_FTP_READ,
+    WRITE_PL = STUSB4500_FTP_WRITE_PL,
+    WRITE_SER = STUSB4500_FTP_WRITE_SER,
+    ERASE_SECTOR = STUSB4500_FTP_ERASE_SECTOR,
+    PROG_SECTOR = STUSB4500_FTP_PROG_SECTOR,
+    SOFT_PROG_SECTOR = STUSB4500_FTP_SOFT_PROG_SECTOR,
+};
+
+inline constexpr uint8_t NUM_SECTORS = STUSB4500_NVM_NUM_SECTORS;
+inline constexpr uint8_t SECTOR_SIZE = STUSB4500_NVM_SECTOR_SIZE;
+
+// Backoff of the status waits, see stusb4500_defs.h
+inline constexpr uint32_t FAST_POLLS = STUSB4500_BACKOFF_FAST_POLLS;
+inline constexpr uint32_t MIN_DELAY_US = STUSB4500_BACKOFF_MIN_DELAY_US;
+inline constexpr uint32_t POLL_US = STUSB4500_BACKOFF_POLL_US;
+inline constexpr uint32_t READY_MAX_DELAY_US = STUSB4500_READY_MAX_DELAY_US;
+inline constexpr uint32_t MESSAGE_MAX_DELAY_US = STUSB4500_MESSAGE_MAX_DELAY_US;
+inline constexpr uint32_t FTP_MAX_DELAY_US = STUSB4500_FTP_MAX_DELAY_US;
+
+constexpr NvmField nvm_field(uint8_t sector, uint8_t offset, uint8_t pos, uint8_t width) {
+    return {sector, offset, pos, static_cast<uint16_t>(((1UL << width) - 1UL) << pos)};
+}
+
+constexpr uint16_t get_le16(uint8_t const* p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+constexpr uint32_t get_le32(uint8_t const* p) {
+    return get_le16(p) | (static_cast<uint32_t>(get_le16(p + 2)) << 16);
+}
+
+constexpr void put_le32(uint8_t* p, uint32_t value) {
+    for (uint8_t i = 0; i < 4; i++) {
+        p[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+constexpr stusb4500_msg_t read_msg(uint8_t reg, void* buf, size_t len) {
+    return {reg, STUSB4500_MSG_READ, buf, len};
+}
+
+constexpr stusb4500_msg_t write_msg(uint8_t reg, void const* buf, size_t len) {
+    return {reg, STUSB4500_MSG_WRITE, const_cast<void*>(buf), len};
+}
+
+template <class Bus, class = void> struct has_transfer : std::false_type {};
+
+template <class Bus>
+struct has_transfer<
+  Bus,
+  std::void_t<decltype(std::declval<Bus&>().transfer(
+    std::declval<stusb4500_msg_t const*>(), std::declval<size_t>()))>> : std::true_type {};
+
+// Perform the accesses in order, one bus transaction each
+template <class Bus> bool transfer_each(Bus& bus, stusb4500_msg_t const* msgs, size_t num_msgs) {
+    for (size_t i = 0; i < num_msgs; i++) {
+        stusb4500_msg_t const& msg = msgs[i];
+        bool const ok = (msg.dir == STUSB4500_MSG_READ) ? bus.read(msg.reg, msg.buf, msg.len)
+                                                        : bus.write(msg.reg, msg.buf, msg.len);
+        if (!ok) return false;
+    }
+    return true;
+}
+
+// Perform the accesses in order, as a single bus transaction if the bus policy supports it
+template <class Bus> bool transfer(Bus& bus, stusb4500_msg_t const* msgs, size_t num_msgs) {
+    if constexpr (has_transfer<Bus>::value) {
+        return bus.transfer(msgs, num_msgs);
+    } else {
+        return transfer_each(bus, msgs, num_msgs);
+    }
+}
+
+template <class Bus, size_t N> bool transfer(Bus& bus, stusb4500_msg_t const (&msgs)[N]) {
+    return transfer(bus, msgs, N);
+}
+
+// Bounded wait without a clock, the deadline is checked against the sleep time plus an estimate
+// of the time spent polling
+class Backoff {
+public:
+    constexpr Backoff(uint32_t timeout_ms, uint32_t max_delay_us)
+        : timeout_us_((timeout_ms ? timeout_ms : STUSB4500_TIMEOUT_MS) * 1000UL),
+          max_delay_us_(max_delay_us) {}
+
+    // Account for a status poll about to be made. Returns false once the deadline has passed
+    constexpr bool poll() {
+        if (elapsed_us_ > timeout_us_) return false;
+
+        polls_++;
+        elapsed_us_ += POLL_US;
+        if (polls_ >= FAST_POLLS) {
+            delay_us_ = delay_us_ ? 2 * delay_us_ : MIN_DELAY_US;
+            if (delay_us_ > max_delay_us_) delay_us_ = max_delay_us_;
+        }
+
+        return true;
+    }
+
+    template <class Bus> void sleep(Bus& bus) {
+        if (!delay_us_) return;
+
+        bus.delay_us(delay_us_);
+        elapsed_us_ += delay_us_;
+    }
+
+private:
+    uint32_t timeout_us_;
+    uint32_t max_delay_us_;
+    uint32_t elapsed_us_ = 0;
+    uint32_t polls_ = 0;
+    uint32_t delay_us_ = 0;
+};
+
+} // namespace detail
+
+#define STUSB4500_NVM_FIELD_LOCATION(field, sector, offset, pos, width)                            \
+    detail::nvm_field(sector, offset, pos, width),
+#define STUSB4500_NVM_FIELD_ID(field, sector, offset, pos, width) field,
+
+// Indexed by stusb4500_nvm_field_t, from the same table as the C driver
+inline constexpr NvmField nvm_fields[] = {STUSB4500_NVM_FIELDS(STUSB4500_NVM_FIELD_LOCATION)};
+
+namespace detail {
+
+inline constexpr stusb4500_nvm_field_t nvm_field_ids[] = {
+  STUSB4500_NVM_FIELDS(STUSB4500_NVM_FIELD_ID)};
+
+// The table is positional, so it must list the fields in enum order
+constexpr bool nvm_fields_in_order() {
+    size_t const count = sizeof(nvm_field_ids) / sizeof(nvm_field_ids[0]);
+
+    for (size_t i = 0; i < count; i++) {
+        if (nvm_field_ids[i] != i) return false;
+    }
+    return count == STUSB4500_NVM_NUM_FIELDS;
+}
+
+} // namespace detail
+
+#undef STUSB4500_NVM_FIELD_LOCATION
+#undef STUSB4500_NVM_FIELD_ID
+
+static_assert(detail::nvm_fields_in_order());
+
+template <stusb4500_nvm_field_t F> inline constexpr NvmField nvm_field = nvm_fields[F];
+
+constexpr uint16_t nvm_get(nvm_t const& nvm, NvmField f) {
+    uint8_t const* p = &nvm[f.sector * detail::SECTOR_SIZE + f.offset];
+    uint16_t const word = (f.msk > 0xFFU) ? detail::get_le16(p) : p[0];
+
+    return static_cast<uint16_t>((word & f.msk) >> f.pos);
+}
+
+// Returns false if the value does not fit the field
+constexpr bool nvm_set(nvm_t& nvm, NvmField f, uint16_t value) {
+    if ((static_cast<uint32_t>(value) << f.pos) & ~static_cast<uint32_t>(f.msk)) return false;
+
+    uint8_t* p = &nvm[f.sector * detail::SECTOR_SIZE + f.offset];
+    uint16_t const word = (f.msk > 0xFFU) ? detail::get_le16(p) : p[0];
+    uint16_t const updated = static_cast<uint16_t>((word & ~f.msk) | (value << f.pos));
+
+    p[0] = static_cast<uint8_t>(updated);
+    if (f.msk > 0xFFU) p[1] = static_cast<uint8_t>(updated >> 8);
+    return true;
+}
+
+template <class Bus> class FtpSession;
+
+template <class Bus> class Device {
+public:
+    // FTP commands and negotiation waits time out after timeout_ms, STUSB4500_TIMEOUT_MS if 0
+    explicit Device(Bus& bus, uint32_t timeout_ms = 0) : bus_(bus), timeout_ms_(timeout_ms) {}
+
+    Bus& bus() {
+        return bus_;
+    }
+
+    uint32_t timeout_ms() const {
+        return timeout_ms_;
+    }
+
+    bool is_present() {
+        uint8_t id;
+        if (!bus_.read(reg::DEVICE_ID, &id, 1)) return false;
+
+        return id == detail::ID_STUSB4500 || id == detail::ID_STUSB4500B;
+    }
+
+    bool is_attached(bool& attached) {
+        uint8_t status;
+        if (!bus_.read(reg::PORT_STATUS_1, &status, 1)) return false;
+
+        attached = (status & detail::ATTACH) != 0;
+        return true;
+    }
+
+    // Wait for PE_SNK_READY. Fails at once on a detach
+    bool wait_ready() {
+        detail::Backoff backoff(timeout_ms_, detail::READY_MAX_DELAY_US);
+        uint8_t state;
+
+        while (backoff.poll()) {
+            if (!bus_.read(reg::PE_FSM, &state, 1)) return false;
+            if (state == STUSB4500_PE_SNK_READY) return true;
+            if (!still_attached()) return false;
+            backoff.sleep(bus_);
+        }
+
+        return false;
+    }
+
+    bool set_gpio_state(stusb4500_gpio_state_t state) {
+        return is_present() && bus_.write(reg::GPIO3_SW_GPIO, &state, 1);
+    }
+
+    // Load sink PDO1 to PDO3 and the number of active PDOs without flashing the NVM
+    bool load_pdos(uint32_t const* snk_pdos, uint8_t num_pdos) {
+        uint8_t buf[STUSB4500_NUM_SNK_PDOS * sizeof(uint32_t)] = {};
+
+        if (!snk_pdos || num_pdos < 1 || num_pdos > STUSB4500_NUM_SNK_PDOS) return false;
+
+        for (uint8_t i = 0; i < num_pdos; i++) {
+            detail::put_le32(&buf[i * sizeof(uint32_t)], snk_pdos[i]);
+        }
+
+        stusb4500_msg_t const msgs[] = {
+          detail::write_msg(reg::DPM_SNK_PDO1, buf, sizeof(buf)),
+          detail::write_msg(reg::DPM_PDO_NUMB, &num_pdos, 1),
+        };
+        return detail::transfer(bus_, msgs);
+    }
+
+    // Ask the source for a new contract
+    bool soft_reset() {
+        uint8_t const header[] = {
+          static_cast<uint8_t>(detail::PD_SOFT_RESET),
+          static_cast<uint8_t>(detail::PD_SOFT_RESET >> 8),
+        };
+
+        return bus_.write(reg::TX_HEADER, header, sizeof(header)) &&
+               bus_.write(reg::PD_COMMAND_CTRL, &detail::PD_CMD, 1);
+    }
+
+    // Send a soft reset and capture the source capabilities message the source answers with. Fails
+    // at once on a detach
+    bool read_src_caps(uint32_t (&src_pdos)[STUSB4500_MAX_SRC_PDOS], uint8_t& num_pdos) {
+        if (!wait_ready() || !soft_reset()) return false;
+
+        detail::Backoff backoff(timeout_ms_, detail::MESSAGE_MAX_DELAY_US);
+        uint8_t buf[STUSB4500_RX_CAPTURE_SIZE];
+        uint8_t prt_status;
+
+        while (backoff.poll()) {
+            if (!bus_.read(reg::PRT_STATUS, &prt_status, 1)) return false;
+            if (!(prt_status & detail::PRT_MESSAGE_RECEIVED)) {
+                if (!still_attached()) return false;
+                backoff.sleep(bus_);
+                continue;
+            }
+
+            // The Accept message of the source partially overwrites the source capabilities, so
+            // the capture immediately follows the status read
+            if (!bus_.read(reg::RX_BYTE_CNT, buf, sizeof(buf))) return false;
+
+            uint16_t const header = detail::get_le16(&buf[reg::RX_HEADER - reg::RX_BYTE_CNT]);
+            uint8_t const num_objects = STUSB4500_HEADER_NUM_DATA_OBJECTS(header);
+            if (
+              !num_objects ||
+              (header & STUSB4500_HEADER_MESSAGE_TYPE_MSK) != detail::SRC_CAPABILITIES_MSG)
+                continue;
+
+            // Check for missing data
+            if (buf[0] != num_objects * sizeof(uint32_t)) return false;
+
+            uint8_t const* objects = &buf[reg::RX_DATA_OBJ - reg::RX_BYTE_CNT];
+            for (uint8_t i = 0; i < num_objects; i++) {
+                src_pdos[i] = detail::get_le32(&objects[i * sizeof(uint32_t)]);
+            }
+            num_pdos = num_objects;
+            return true;
+        }
+
+        return false;
+    }
+
+    // Read the sectors selected by the sector mask into their place in the NVM image
+    bool nvm_read(nvm_t& nvm, uint8_t sectors = STUSB4500_NVM_ALL_SECTORS) {
+        FtpSession<Bus> ftp(*this);
+        if (!ftp) return false;
+
+        for (uint8_t sector = 0; sector < detail::NUM_SECTORS; sector++) {
+            if (!(sectors & (1U << sector))) continue;
+            if (!ftp.read_sector(sector, &nvm[sector * detail::SECTOR_SIZE])) return false;
+        }
+
+        return ftp.close();
+    }
+
+    template <stusb4500_nvm_field_t F> bool nvm_read_field(uint16_t& value) {
+        nvm_t nvm;
+        if (!nvm_read(nvm, nvm_field<F>.sectors())) return false;
+
+        value = nvm_get(nvm, nvm_field<F>);
+        return true;
+    }
+
+    // Erase and program the sectors which differ from the NVM, then verify them
+    bool nvm_write(nvm_t const& image) {
+        nvm_t nvm;
+        uint8_t sectors = 0;
+
+        if (!nvm_read(nvm)) return false;
+
+        for (uint8_t sector = 0; sector < detail::NUM_SECTORS; sector++) {
+            for (uint8_t i = 0; i < detail::SECTOR_SIZE; i++) {
+                uint8_t const offset = sector * detail::SECTOR_SIZE + i;
+                if (nvm[offset] != image[offset]) sectors |= 1U << sector;
+            }
+        }
+
+        if (!sectors) return true;
+
+        {
+            FtpSession<Bus> ftp(*this);
+            if (!ftp || !ftp.erase(sectors)) return false;
+
+            for (uint8_t sector = 0; sector < detail::NUM_SECTORS; sector++) {
+                if (!(sectors & (1U << sector))) continue;
+                if (!ftp.write_sector(sector, &image[sector * detail::SECTOR_SIZE])) return false;
+            }
+
+            if (!ftp.close()) return false;
+        }
+
+        if (!nvm_read(nvm, sectors)) return false;
+
+        for (uint8_t i = 0; i < STUSB4500_NVM_SIZE; i++) {
+            if (nvm[i] != image[i]) return false;
+        }
+        return true;
+    }
+
+private:
+    // Checked after a status poll came up empty, so a hit is acted on without delay
+    bool still_attached() {
+        bool attached;
+        return is_attached(attached) && attached;
+    }
+
+    Bus& bus_;
+    uint32_t timeout_ms_;
+};
+
+template <class Bus> Device(Bus&) -> Device<Bus>;
+
+// Unlocked FTP controller. The constructor enters read mode, the destructor clears the FTP control
+// registers and the password unless close() already did. Failed steps thus never leave the NVM
+// unlocked
+template <class Bus> class FtpSession {
+public:
+    explicit FtpSession(Device<Bus>& dev) : dev_(dev), bus_(dev.bus()) {
+        // Write the password and reset the internal controller, the registers are adjacent, then
+        // power on
+        uint8_t const unlock[] = {detail::FTP_PASSWORD, detail::FTP_RESET};
+        stusb4500_msg_t const msgs[] = {
+          detail::write_msg(reg::FTP_CUST_PASSWORD, unlock, sizeof(unlock)),
+          detail::write_msg(reg::FTP_CTRL_0, &detail::FTP_POWER_ON, 1),
+        };
+
+        open_ = true;
+        ok_ = detail::transfer(bus_, msgs);
+    }
+
+    ~FtpSession() {
+        close();
+    }
+
+    FtpSession(FtpSession const&) = delete;
+    FtpSession& operator=(FtpSession const&) = delete;
+
+    // False if entering read mode or any step since has failed
+    explicit operator bool() const {
+        return ok_;
+    }
+
+    // Lock the NVM again. Returns false if any step of the session has failed
+    bool close() {
+        if (!open_) return ok_;
+        open_ = false;
+
+        // Clear FTP_CTRL registers, then clear password
+        uint8_t const ctrl[] = {detail::FTP_CUST_RST_N, 0x00};
+        uint8_t const password = 0x00;
+        stusb4500_msg_t const msgs[] = {
+          detail::write_msg(reg::FTP_CTRL_0, ctrl, sizeof(ctrl)),
+          detail::write_msg(reg::FTP_CUST_PASSWORD, &password, 1),
+        };
+
+        bool const locked = detail::transfer(bus_, msgs);
+        ok_ = ok_ && locked;
+        return ok_;
+    }
+
+    bool read_sector(uint8_t sector, uint8_t* data) {
+        if (!usable()) return false;
+
+        // Select sector to read and load sector read command, then read sector data bytes from
+        // RW_BUFFER register and reset internal controller
+        stusb4500_msg_t const setup[] = {
+          detail::write_msg(reg::FTP_CTRL_0, &detail::FTP_POWER_ON, 1),
+        };
+        stusb4500_msg_t const msgs[] = {
+          detail::read_msg(reg::RW_BUFFER, data, detail::SECTOR_SIZE),
+          detail::write_msg(reg::FTP_CTRL_0, &detail::FTP_RESET, 1),
+        };
+
+        return check(run(detail::READ, sector, setup) && detail::transfer(bus_, msgs));
+    }
+
+    // Erase the sectors selected by the sector mask, required before programming them
+    bool erase(uint8_t sectors) {
+        if (!usable()) return false;
+
+        // RW_BUFFER register must be NULL for Partial Erase feature
+        uint8_t const rw_buffer = 0x00;
+        stusb4500_msg_t const setup[] = {
+          detail::write_msg(reg::RW_BUFFER, &rw_buffer, 1),
+          detail::write_msg(reg::FTP_CTRL_0, &detail::FTP_POWER_ON, 1),
+        };
+        uint8_t const ser =
+          static_cast<uint8_t>(((sectors << 3) & detail::FTP_CUST_SER) | detail::WRITE_SER);
+
+        return check(
+          run(ser, 0, setup) && run(detail::SOFT_PROG_SECTOR, 0) &&
+          run(detail::ERASE_SECTOR, 0));
+    }
+
+    bool write_sector(uint8_t sector, uint8_t const* data) {
+        if (!usable()) return false;
+
+        // Write the 8 byte programming data to the RW_BUFFER register and load PL write command,
+        // then program the sector
+        stusb4500_msg_t const setup[] = {
+          detail::write_msg(reg::RW_BUFFER, data, detail::SECTOR_SIZE),
+          detail::write_msg(reg::FTP_CTRL_0, &detail::FTP_POWER_ON, 1),
+        };
+
+        return check(run(detail::WRITE_PL, 0, setup) && run(detail::PROG_SECTOR, sector));
+    }
+
+private:
+    // No further commands after a failure
+    bool usable() const {
+        return open_ && ok_;
+    }
+
+    bool check(bool ok) {
+        ok_ = ok;
+        return ok_;
+    }
+
+    // Issue a command and wait for its execution. The setup accesses, the command and the first
+    // status poll share one bus transaction
+    bool run(uint8_t ctrl1, uint8_t sector, stusb4500_msg_t const* setup, size_t num_setup) {
+        uint8_t const opcode = ctrl1 & (detail::FTP_CUST_SER | detail::FTP_CUST_OPCODE);
+        uint8_t const command = (sector & detail::FTP_CUST_SECT) | detail::FTP_POWER_ON |
+                                detail::FTP_CUST_REQ;
+        uint8_t ctrl0;
+        stusb4500_msg_t msgs[detail::FTP_MAX_SETUP_MSGS + 3];
+        size_t n = 0;
+
+        if (num_setup > detail::FTP_MAX_SETUP_MSGS) return false;
+
+        while (n < num_setup) {
+            msgs[n] = setup[n];
+            n++;
+        }
+        msgs[n++] = detail::write_msg(reg::FTP_CTRL_1, &opcode, 1);
+        msgs[n++] = detail::write_msg(reg::FTP_CTRL_0, &command, 1);
+        msgs[n++] = detail::read_msg(reg::FTP_CTRL_0, &ctrl0, 1);
+
+        detail::Backoff backoff(dev_.timeout_ms(), detail::FTP_MAX_DELAY_US);
+        if (!backoff.poll() || !detail::transfer(bus_, msgs, n)) return false;
+
+        while (ctrl0 & detail::FTP_CUST_REQ) {
+            backoff.sleep(bus_);
+            if (!backoff.poll() || !bus_.read(reg::FTP_CTRL_0, &ctrl0, 1)) return false;
+        }
+
+        return true;
+    }
+
+    bool run(uint8_t ctrl1, uint8_t sector) {
+        return run(ctrl1, sector, nullptr, 0);
+    }
+
+    template <size_t N> bool run(uint8_t ctrl1, uint8_t sector, stusb4500_msg_t const (&setup)[N]) {
+        return run(ctrl1, sector, setup, N);
+    }
+
+    Device<Bus>& dev_;
+    Bus& bus_;
+    bool open_ = false;
+    bool ok_ = false;
+};
+
+// Bus policy over a C device handle, e.g. to run this layer on stusb4500_sim.h. Accesses go
+// through the function pointers and skip the lock and metrics hooks of the handle
+class CBus {
+public:
+    explicit CBus(stusb4500_t const& dev) : dev_(dev) {}
+
+    bool read(uint8_t reg, void* buf, size_t len) {
+        return dev_.read(dev_.addr, reg, buf, len, dev_.context);
+    }
+
+    bool write(uint8_t reg, void const* buf, size_t len) {
+        return dev_.write(dev_.addr, reg, buf, len, dev_.context);
+    }
+
+    void delay_us(uint32_t us) {
+        if (dev_.delay) dev_.delay(us, dev_.context);
+    }
+
+    // Accesses one at a time if the handle has no combined transfers
+    bool transfer(stusb4500_msg_t const* msgs, size_t num_msgs) {
+        if (dev_.transfer) return dev_.transfer(dev_.addr, msgs, num_msgs, dev_.context);
+
+        return detail::transfer_each(*this, msgs, num_msgs);
+    }
+
+private:
+    stusb4500_t const& dev_;
+};
+
+} // namespace stusb4500
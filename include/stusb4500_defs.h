@@ -0,0 +1,71 @@
+#pragma once
+
+// Definitions shared by the driver sources and the C++ layer of stusb4500.hpp, so both drive the
+// FTP controller, lay out the NVM and back off their status polls identically. See
+// src/stusb4500_nvm.c for the FTP register description.
+
+// FTP controller
+#define STUSB4500_FTP_CUST_PASSWORD_REG 0x95UL
+#define STUSB4500_FTP_CUST_PASSWORD 0x47UL
+#define STUSB4500_FTP_CTRL_0 0x96UL
+#define STUSB4500_FTP_CUST_PWR 0x80UL
+#define STUSB4500_FTP_CUST_RST_N 0x40UL
+#define STUSB4500_FTP_CUST_REQ 0x10UL
+#define STUSB4500_FTP_CUST_SECT 0x07UL
+#define STUSB4500_FTP_CTRL_1 0x97UL
+#define STUSB4500_FTP_CUST_SER 0xF8UL
+#define STUSB4500_FTP_CUST_OPCODE 0x07UL
+#define STUSB4500_RW_BUFFER 0x53UL
+
+// FTP opcodes
+#define STUSB4500_FTP_READ 0x00UL             // Read memory array
+#define STUSB4500_FTP_WRITE_PL 0x01UL         // Shift in data on Program Load (PL) Register
+#define STUSB4500_FTP_WRITE_SER 0x02UL        // Shift in data on Sector Erase (SER) Register
+#define STUSB4500_FTP_READ_PL 0x03UL          // Shift out data on Program Load (PL) Register
+#define STUSB4500_FTP_READ_SER 0x04UL         // Shift out data on Sector Erase (SER) Register
+#define STUSB4500_FTP_ERASE_SECTOR 0x05UL     // Erase memory array
+#define STUSB4500_FTP_PROG_SECTOR 0x06UL      // Program 256b word into EEPROM
+#define STUSB4500_FTP_SOFT_PROG_SECTOR 0x07UL // Soft Program array
+
+// 5 sectors, 8 bytes each
+#define STUSB4500_NVM_NUM_SECTORS 5UL
+#define STUSB4500_NVM_SECTOR_SIZE 8UL
+
+// Customer fields of the NVM as X(field, sector, offset, pos, width), in the order of
+// stusb4500_nvm_field_t. See the STUSB4500 NVM description. Fields span at most two bytes, which
+// are read as a little endian word
+#define STUSB4500_NVM_FIELDS(X)                                                                    \
+    X(STUSB4500_NVM_GPIO_CFG, 1, 0, 4, 2)                                                          \
+    X(STUSB4500_NVM_VBUS_DISCH_DISABLE, 1, 1, 5, 1)                                                \
+    X(STUSB4500_NVM_VBUS_DISCH_TIME_TO_0V, 1, 2, 4, 4)                                             \
+    X(STUSB4500_NVM_VBUS_DISCH_TIME_TO_PDO, 1, 2, 0, 4)                                            \
+    X(STUSB4500_NVM_USB_COMM_CAPABLE, 3, 2, 0, 1)                                                  \
+    X(STUSB4500_NVM_SNK_PDO_NUMB, 3, 2, 1, 2)                                                      \
+    X(STUSB4500_NVM_SNK_UNCONS_POWER, 3, 2, 3, 1)                                                  \
+    X(STUSB4500_NVM_I_SNK_PDO1, 3, 2, 4, 4)                                                        \
+    X(STUSB4500_NVM_I_SNK_PDO2, 3, 4, 0, 4)                                                        \
+    X(STUSB4500_NVM_I_SNK_PDO3, 3, 5, 4, 4)                                                        \
+    X(STUSB4500_NVM_SHIFT_VBUS_HL1, 3, 3, 4, 4)                                                    \
+    X(STUSB4500_NVM_SHIFT_VBUS_LL2, 3, 4, 4, 4)                                                    \
+    X(STUSB4500_NVM_SHIFT_VBUS_HL2, 3, 5, 0, 4)                                                    \
+    X(STUSB4500_NVM_SHIFT_VBUS_LL3, 3, 6, 0, 4)                                                    \
+    X(STUSB4500_NVM_SHIFT_VBUS_HL3, 3, 6, 4, 4)                                                    \
+    X(STUSB4500_NVM_V_SNK_PDO2, 4, 0, 6, 9)                                                        \
+    X(STUSB4500_NVM_V_SNK_PDO3, 4, 2, 0, 9)                                                        \
+    X(STUSB4500_NVM_I_SNK_PDO_FLEX, 4, 3, 2, 10)                                                   \
+    X(STUSB4500_NVM_POWER_OK_CFG, 4, 4, 5, 2)                                                      \
+    X(STUSB4500_NVM_POWER_ONLY_ABOVE_5V, 4, 6, 3, 1)                                               \
+    X(STUSB4500_NVM_REQ_SRC_CURRENT, 4, 6, 4, 1)
+
+// Backoff of the status polls. The first polls are made back to back, then the delay between polls
+// doubles up to a per-wait limit
+#define STUSB4500_BACKOFF_FAST_POLLS 4UL
+#define STUSB4500_BACKOFF_MIN_DELAY_US 50UL
+// Assumed duration of a status poll, roughly a short read at 400 kHz
+#define STUSB4500_BACKOFF_POLL_US 100UL
+
+// Backoff limits. The source capabilities must be read within a few ms of their arrival, before
+// the Accept message overwrites them. FTP commands take far longer than their limit
+#define STUSB4500_READY_MAX_DELAY_US 1000UL
+#define STUSB4500_MESSAGE_MAX_DELAY_US 200UL
+#define STUSB4500_FTP_MAX_DELAY_US 500UL
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "stusb4500.h"
+
+// Negotiation and NVM readout for many STUSB4500s at once. Devices are grouped by I2C bus: devices
+// on the same bus are served by one worker which interleaves their transactions, so the time one
+// device spends waiting for its source is used to talk to the others. Separate buses are served in
+// parallel if STUSB4500_FLEET_THREADS is defined, otherwise by a single worker.
+
+#ifndef STUSB4500_FLEET_MAX_BUSES
+// Buses of one run with STUSB4500_FLEET_THREADS, larger fleets are rejected
+#define STUSB4500_FLEET_MAX_BUSES 16UL
+#endif // STUSB4500_FLEET_MAX_BUSES
+
+typedef struct {
+    stusb4500_t const* dev;
+
+    // Results of stusb4500_fleet_negotiate()
+    stusb4500_negotiate_status_t status;
+    // Time from the start of the run to the end of this device's negotiation, 0 without get_ms
+    uint32_t elapsed_ms;
+
+    // Results of stusb4500_fleet_nvm_read()
+    bool nvm_ok;
+    uint8_t nvm[STUSB4500_NVM_SIZE];
+
+    // Working storage
+    stusb4500_negotiation_t negotiation;
+    bool on_interrupt;
+} stusb4500_fleet_device_t;
+
+// Devices sharing a bus. Devices behind a mux can share a bus if their handles select the mux
+// channel as part of every transaction
+typedef struct {
+    stusb4500_fleet_device_t* devices;
+    size_t num_devices;
+} stusb4500_fleet_bus_t;
+
+// Negotiate every device of every bus with the same config. See stusb4500_negotiate(). With
+// on_interrupt, a device which misses the capabilities its source sent on attach solicits them
+// with a soft reset. Returns true if all negotiations are done or skipped, check each device's
+// status otherwise
+bool stusb4500_fleet_negotiate(
+  stusb4500_fleet_bus_t* buses,
+  size_t num_buses,
+  stusb4500_config_t const* config,
+  bool on_interrupt);
+// Read the NVM of every device of every bus. Returns true if all reads succeeded
+bool stusb4500_fleet_nvm_read(stusb4500_fleet_bus_t* buses, size_t num_buses);
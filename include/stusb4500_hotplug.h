@@ -0,0 +1,51 @@
+#pragma once
+
+#include "stusb4500.h"
+
+// Hot-plug handling for docks and other ports which see frequent plugging. Attaches are debounced
+// before a negotiation is started, detaches are acted on at once: an outstanding negotiation is
+// cancelled and the next attach is handled right away.
+
+// Time an attach must be stable before the negotiation starts
+#define STUSB4500_HOTPLUG_DEBOUNCE_MS 50UL
+
+enum {
+    STUSB4500_HOTPLUG_NONE = 0UL,
+    // Attach stable for the debounce time, the negotiation has started
+    STUSB4500_HOTPLUG_ATTACHED = 1UL,
+    // Cable detached, an outstanding negotiation has been cancelled
+    STUSB4500_HOTPLUG_DETACHED = 2UL,
+    // Negotiation after the attach done or skipped
+    STUSB4500_HOTPLUG_NEGOTIATED = 3UL,
+    // Negotiation after the attach failed, retried at the next attach
+    STUSB4500_HOTPLUG_FAILED = 4UL,
+};
+typedef uint8_t stusb4500_hotplug_event_t;
+
+typedef struct {
+    stusb4500_t const* dev;
+    // Negotiation settings, its get_ms times the debounce
+    stusb4500_config_t const* config;
+    // STUSB4500_HOTPLUG_DEBOUNCE_MS if 0. Without get_ms, an attach is accepted at the second
+    // consecutive poll which sees it
+    uint32_t debounce_ms;
+
+    // Treat as opaque
+    bool attached;
+    bool settling;
+    uint32_t settle_start_ms;
+    bool negotiating;
+    stusb4500_negotiation_t negotiation;
+} stusb4500_hotplug_t;
+
+void stusb4500_hotplug_init(
+  stusb4500_hotplug_t* hotplug, stusb4500_t const* dev, stusb4500_config_t const* config);
+// Check the attach state, or advance the negotiation, with at most one bus transaction. Call
+// periodically, and while stusb4500_hotplug_is_negotiating() as stusb4500_negotiate_poll() requires
+stusb4500_hotplug_event_t stusb4500_hotplug_poll(stusb4500_hotplug_t* hotplug);
+// Report a detach seen elsewhere, e.g. by the ALERT handler or a port monitor. Cancels an
+// outstanding negotiation without bus traffic. Call from the polling thread
+stusb4500_hotplug_event_t stusb4500_hotplug_detached(stusb4500_hotplug_t* hotplug);
+bool stusb4500_hotplug_is_negotiating(stusb4500_hotplug_t const* hotplug);
+// Microseconds to sleep before the next poll while negotiating, see stusb4500_negotiate_delay_us()
+uint32_t stusb4500_hotplug_delay_us(stusb4500_hotplug_t const* hotplug);
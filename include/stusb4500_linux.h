@@ -0,0 +1,33 @@
+#pragma once
+
+#include "stusb4500.h"
+
+// Linux backend on /dev/i2c-N. Every read is a register address write and a data read combined
+// with a repeated start, and every transfer of the library is submitted as one I2C_RDWR ioctl. Any
+// number of devices can be bound to one bus.
+
+// Messages and write payload bytes per ioctl. Larger transfers fail without touching the bus
+#define STUSB4500_LINUX_MAX_MSGS 42UL
+#define STUSB4500_LINUX_BUFFER_SIZE 512UL
+
+// ioctl() of the bus, replaceable to test without an adapter. Returns a negative value on failure
+typedef int (*stusb4500_linux_ioctl_t)(int fd, unsigned long request, void* arg);
+
+typedef struct {
+    int fd;
+    // Optional, NULL to use ioctl()
+    stusb4500_linux_ioctl_t ioctl;
+    // Number of ioctls submitted
+    uint32_t ioctls;
+} stusb4500_linux_bus_t;
+
+// Open a bus, e.g. "/dev/i2c-1". Set bus->ioctl afterwards to intercept the ioctls
+bool stusb4500_linux_open(stusb4500_linux_bus_t* bus, char const* path);
+void stusb4500_linux_close(stusb4500_linux_bus_t* bus);
+// Point a device handle with the given 7-bit address at the bus
+void stusb4500_linux_bind(stusb4500_linux_bus_t* bus, stusb4500_t* dev, uint16_t addr);
+
+bool stusb4500_linux_read(uint16_t addr, uint8_t reg, void* buf, size_t len, void* context);
+bool stusb4500_linux_write(uint16_t addr, uint8_t reg, void const* buf, size_t len, void* context);
+bool stusb4500_linux_transfer(
+  uint16_t addr, stusb4500_msg_t const* msgs, size_t num_msgs, void* context);
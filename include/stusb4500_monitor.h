@@ -0,0 +1,76 @@
+#pragma once
+
+#include "stusb4500.h"
+
+// Port monitor. One thread polls the status registers of a device periodically, with one bus
+// transaction per poll, and publishes a decoded snapshot through a seqlock. Any number of readers
+// get the latest snapshot without bus traffic or locks. A change callback reports real transitions
+// only.
+
+// Changed parts of a snapshot
+enum {
+    STUSB4500_PORT_ATTACH = 0x01UL,
+    STUSB4500_PORT_PE_STATE = 0x02UL,
+    STUSB4500_PORT_CONTRACT = 0x04UL,
+    STUSB4500_PORT_SNK_PDOS = 0x08UL,
+};
+typedef uint8_t stusb4500_port_change_t;
+
+typedef struct {
+    // Time of the poll, 0 without get_ms
+    uint32_t timestamp_ms;
+    bool attached;
+    // Raw PE_FSM state, see STUSB4500_PE_SNK_READY
+    uint8_t pe_state;
+    // Active request data object, 0 without a contract
+    uint32_t rdo;
+    // Requested source PDO position, starting at 1, 0 without a contract
+    uint8_t position;
+    // Requested voltage, 0 if the source PDOs are unknown, see stusb4500_monitor_set_src_pdos()
+    stusb4500_voltage_t voltage_mv;
+    stusb4500_current_t current_ma;
+    stusb4500_current_t max_current_ma;
+    // Active sink PDOs
+    uint8_t num_snk_pdos;
+    uint32_t snk_pdos[STUSB4500_NUM_SNK_PDOS];
+} stusb4500_port_snapshot_t;
+
+#define STUSB4500_MONITOR_WORDS ((sizeof(stusb4500_port_snapshot_t) + 3UL) / 4UL)
+
+// Called from stusb4500_monitor_poll() with the previous and the new snapshot
+typedef void (*stusb4500_monitor_callback_t)(
+  stusb4500_port_snapshot_t const* prev,
+  stusb4500_port_snapshot_t const* now,
+  stusb4500_port_change_t changes,
+  void* context);
+
+typedef struct {
+    stusb4500_t const* dev;
+    // Optional, NULL to not report changes
+    stusb4500_monitor_callback_t on_change;
+    void* context;
+    // Optional, NULL to not timestamp snapshots
+    stusb4500_get_ms_func_t get_ms;
+
+    // Writer state, treat as opaque
+    stusb4500_port_snapshot_t last;
+    bool valid;
+    uint8_t num_src_pdos;
+    uint32_t src_pdos[STUSB4500_MAX_SRC_PDOS];
+
+    // Published snapshot, odd sequence while being written
+    uint32_t sequence;
+    uint32_t words[STUSB4500_MONITOR_WORDS];
+} stusb4500_monitor_t;
+
+void stusb4500_monitor_init(stusb4500_monitor_t* monitor, stusb4500_t const* dev);
+// Read the status registers in one bus transaction, publish the snapshot and report changes. Call
+// periodically, from one thread at a time
+bool stusb4500_monitor_poll(stusb4500_monitor_t* monitor);
+// Copy the latest snapshot, from any thread. Returns false if none has been published yet
+bool stusb4500_monitor_read(
+  stusb4500_monitor_t const* monitor, stusb4500_port_snapshot_t* snapshot);
+// Source capabilities of the attached source, used to decode the requested voltage. Call from the
+// polling thread. Forgotten on detach
+void stusb4500_monitor_set_src_pdos(
+  stusb4500_monitor_t* monitor, uint32_t const* src_pdos, uint8_t num_src_pdos);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "stusb4500.h"
+
+// End-of-line NVM programming of many STUSB4500s behind an I2C mux. Each unit goes through the same
+// sequence as stusb4500_nvm_flash(), but while one unit erases or programs its NVM, the others are
+// served, so the bus is kept busy instead of polling a single unit.
+
+// Select the mux channel of a unit. Called before talking to a unit on another channel
+typedef bool (*stusb4500_select_channel_t)(size_t channel, void* context);
+
+typedef struct {
+    stusb4500_t const* dev;
+    size_t channel;
+
+    // Results
+    bool pass;
+    // Sectors erased and programmed
+    uint8_t sectors;
+    // Time from the start of the run to the end of this unit, 0 without get_ms
+    uint32_t elapsed_ms;
+
+    // Working storage
+    uint8_t state;
+    uint8_t sector;
+    uint8_t ctrl0;
+    stusb4500_backoff_t backoff;
+    uint8_t nvm[STUSB4500_NVM_SIZE];
+    uint8_t image[STUSB4500_NVM_SIZE];
+} stusb4500_production_unit_t;
+
+typedef struct {
+    stusb4500_production_unit_t* units;
+    size_t num_units;
+    // Optional, NULL if all units can be reached at all times
+    stusb4500_select_channel_t select_channel;
+    void* context;
+    // Optional, used for the per-unit timings and the FTP command deadlines. Without it, the
+    // deadlines are estimated from the number of status polls
+    stusb4500_get_ms_func_t get_ms;
+} stusb4500_production_t;
+
+// Flash the config to all units. Returns true if all units passed, check each unit otherwise
+bool stusb4500_production_flash(
+  stusb4500_production_t* production, stusb4500_nvm_config_t const* config);
+// Flash a serialized NVM image to all units without reading their NVM first, see
+// stusb4500_nvm_flash_image()
+bool stusb4500_production_flash_image(stusb4500_production_t* production, uint8_t const* image);
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "stusb4500.h"
+
+// Bus recorder. A recording device handle forwards every register access to a wrapped device handle
+// and writes it, with its payload and result, to a sink. Recordings can be replayed on a host with
+// stusb4500_replay.h.
+//
+// Format, little endian:
+//   Header: magic "S45R", version, flags (STUSB4500_RECORD_HAS_*), 16-bit device address
+//   Record: type (STUSB4500_RECORD_*), 32-bit timestamp in ms, then for bus records:
+//     result (1 if the access succeeded), number of messages, then for each message:
+//     direction, register, 16-bit length, payload (written bytes or read response)
+//   and for wait records: result (1 if ALERT was asserted), 32-bit timeout in ms
+
+#define STUSB4500_RECORD_MAGIC "S45R"
+#define STUSB4500_RECORD_VERSION 2UL
+#define STUSB4500_RECORD_HEADER_SIZE 8UL
+
+// Hooks of the wrapped device handle, the request stream depends on them
+#define STUSB4500_RECORD_HAS_TRANSFER 0x01UL
+#define STUSB4500_RECORD_HAS_WAIT_ALERT 0x02UL
+#define STUSB4500_RECORD_HAS_DELAY 0x04UL
+
+enum {
+    STUSB4500_RECORD_READ = 1UL,
+    STUSB4500_RECORD_WRITE = 2UL,
+    STUSB4500_RECORD_TRANSFER = 3UL,
+    // A call to stusb4500_record_get_ms(), the timestamp is the returned value
+    STUSB4500_RECORD_CLOCK = 4UL,
+    // A call to the wait_alert hook
+    STUSB4500_RECORD_WAIT_ALERT = 5UL,
+};
+typedef uint8_t stusb4500_record_type_t;
+
+// Write len bytes of the recording. Returns false on failure
+typedef bool (*stusb4500_record_sink_t)(void const* buf, size_t len, void* context);
+
+typedef struct {
+    // Wrapped device handle
+    stusb4500_t const* dev;
+    stusb4500_record_sink_t sink;
+    void* sink_context;
+    // Optional, NULL to record timestamps of 0. Also the clock of stusb4500_record_get_ms()
+    stusb4500_get_ms_func_t get_ms;
+
+    // Results
+    uint32_t records;
+    // The sink failed, the recording is incomplete
+    bool sink_failed;
+} stusb4500_record_t;
+
+// Write the header and point a device handle at the recorder. The handle gets the hooks of the
+// wrapped handle. The recorder becomes the one of stusb4500_record_get_ms()
+bool stusb4500_record_start(stusb4500_record_t* record, stusb4500_t* dev);
+// Recorded clock of the most recently started recorder. Use it as the get_ms function of the
+// recorded operations, so their timeouts replay identically
+uint32_t stusb4500_record_get_ms(void);
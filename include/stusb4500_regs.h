@@ -0,0 +1,143 @@
+#pragma once
+
+#include "stusb4500.h"
+
+// Snapshot of the user register space for diagnostics. stusb4500_regs_read() reads it in two
+// bursts, in one bus transaction if the device handle supports combined transfers, and the inline
+// accessors below decode fields of the snapshot on demand.
+
+// Status, control and PD message block, see STUSB4500 Section 6
+#define STUSB4500_REG_BCD_TYPEC_REV_LOW 0x06UL
+#define STUSB4500_REG_ALERT_STATUS_1 0x0BUL
+#define STUSB4500_REG_ALERT_STATUS_1_MASK 0x0CUL
+#define STUSB4500_REG_PORT_STATUS_0 0x0DUL
+#define STUSB4500_REG_PORT_STATUS_1 0x0EUL
+#define STUSB4500_REG_TYPEC_MONITORING_STATUS_0 0x0FUL
+#define STUSB4500_REG_TYPEC_MONITORING_STATUS_1 0x10UL
+#define STUSB4500_REG_CC_STATUS 0x11UL
+#define STUSB4500_REG_CC_HW_FAULT_STATUS_0 0x12UL
+#define STUSB4500_REG_CC_HW_FAULT_STATUS_1 0x13UL
+#define STUSB4500_REG_PD_TYPEC_STATUS 0x14UL
+#define STUSB4500_REG_TYPEC_STATUS 0x15UL
+#define STUSB4500_REG_PRT_STATUS 0x16UL
+#define STUSB4500_REG_PD_COMMAND_CTRL 0x1AUL
+#define STUSB4500_REG_RESET_CTRL 0x23UL
+#define STUSB4500_REG_PE_FSM 0x29UL
+#define STUSB4500_REG_GPIO3_SW_GPIO 0x2DUL
+#define STUSB4500_REG_DEVICE_ID 0x2FUL
+#define STUSB4500_REG_RX_BYTE_CNT 0x30UL
+#define STUSB4500_REG_RX_HEADER 0x31UL
+#define STUSB4500_REG_RX_DATA_OBJ 0x33UL
+#define STUSB4500_REG_TX_HEADER 0x51UL
+#define STUSB4500_REG_STATUS_END 0x53UL
+
+// Sink PDO block
+#define STUSB4500_REG_DPM_PDO_NUMB 0x70UL
+#define STUSB4500_REG_DPM_SNK_PDO1 0x85UL
+#define STUSB4500_REG_RDO_STATUS 0x91UL
+#define STUSB4500_REG_DPM_END 0x95UL
+
+#define STUSB4500_REGS_STATUS_SIZE (STUSB4500_REG_STATUS_END - STUSB4500_REG_BCD_TYPEC_REV_LOW)
+#define STUSB4500_REGS_DPM_SIZE (STUSB4500_REG_DPM_END - STUSB4500_REG_DPM_PDO_NUMB)
+
+// Register fields
+#define STUSB4500_PORT_STATUS_1_ATTACH 0x01UL
+#define STUSB4500_DPM_PDO_NUMB_MSK 0x07UL
+// See USB PD spec Table 6-1, bit 4 of the message type is reserved before revision 3.0
+#define STUSB4500_HEADER_MESSAGE_TYPE_MSK 0x1FUL
+#define STUSB4500_HEADER_NUM_DATA_OBJECTS_POS 12UL
+#define STUSB4500_HEADER_NUM_DATA_OBJECTS_MSK (0x07UL << STUSB4500_HEADER_NUM_DATA_OBJECTS_POS)
+#define STUSB4500_HEADER_NUM_DATA_OBJECTS(header)                                                  \
+    (((header)&STUSB4500_HEADER_NUM_DATA_OBJECTS_MSK) >> STUSB4500_HEADER_NUM_DATA_OBJECTS_POS)
+// See USB PD spec Section 6.4.2
+#define STUSB4500_RDO_OBJECT_POSITION_POS 28UL
+#define STUSB4500_RDO_OBJECT_POSITION_MSK (0x07UL << STUSB4500_RDO_OBJECT_POSITION_POS)
+#define STUSB4500_RDO_OPERATING_CURRENT_POS 10UL
+#define STUSB4500_RDO_OPERATING_CURRENT_MSK (0x03FFUL << STUSB4500_RDO_OPERATING_CURRENT_POS)
+#define STUSB4500_RDO_MAX_CURRENT_POS 0UL
+#define STUSB4500_RDO_MAX_CURRENT_MSK (0x03FFUL << STUSB4500_RDO_MAX_CURRENT_POS)
+#define STUSB4500_RDO_CURRENT_RESOLUTION_MA 10UL
+#define STUSB4500_PDO_TYPE_POS 30UL
+
+typedef struct {
+    // BCD_TYPEC_REV_LOW to TX_HEADER
+    uint8_t status[STUSB4500_REGS_STATUS_SIZE];
+    // DPM_PDO_NUMB to RDO_STATUS
+    uint8_t dpm[STUSB4500_REGS_DPM_SIZE];
+} stusb4500_regs_t;
+
+// Read the register snapshot. Like stusb4500_alert_read(), this clears the latched alerts and
+// the transition bits of the status registers
+bool stusb4500_regs_read(stusb4500_t const* dev, stusb4500_regs_t* regs);
+
+// Register value by address, 0 for registers outside of the snapshot
+static inline uint8_t stusb4500_regs_get(stusb4500_regs_t const* regs, uint8_t reg) {
+    if (reg >= STUSB4500_REG_BCD_TYPEC_REV_LOW && reg < STUSB4500_REG_STATUS_END)
+        return regs->status[reg - STUSB4500_REG_BCD_TYPEC_REV_LOW];
+    if (reg >= STUSB4500_REG_DPM_PDO_NUMB && reg < STUSB4500_REG_DPM_END)
+        return regs->dpm[reg - STUSB4500_REG_DPM_PDO_NUMB];
+    return 0;
+}
+
+// Little endian 16-bit and 32-bit values starting at reg
+static inline uint16_t stusb4500_regs_get16(stusb4500_regs_t const* regs, uint8_t reg) {
+    return (uint16_t)(stusb4500_regs_get(regs, reg) | (stusb4500_regs_get(regs, reg + 1) << 8));
+}
+
+static inline uint32_t stusb4500_regs_get32(stusb4500_regs_t const* regs, uint8_t reg) {
+    return (uint32_t)stusb4500_regs_get16(regs, reg) |
+           ((uint32_t)stusb4500_regs_get16(regs, reg + 2) << 16);
+}
+
+static inline bool stusb4500_regs_attached(stusb4500_regs_t const* regs) {
+    return (stusb4500_regs_get(regs, STUSB4500_REG_PORT_STATUS_1) &
+            STUSB4500_PORT_STATUS_1_ATTACH) != 0;
+}
+
+// Policy engine state, see STUSB4500_PE_SNK_READY
+static inline uint8_t stusb4500_regs_pe_state(stusb4500_regs_t const* regs) {
+    return stusb4500_regs_get(regs, STUSB4500_REG_PE_FSM);
+}
+
+// Last received PD message
+static inline uint16_t stusb4500_regs_rx_header(stusb4500_regs_t const* regs) {
+    return stusb4500_regs_get16(regs, STUSB4500_REG_RX_HEADER);
+}
+
+static inline uint8_t stusb4500_regs_rx_message_type(stusb4500_regs_t const* regs) {
+    return stusb4500_regs_rx_header(regs) & STUSB4500_HEADER_MESSAGE_TYPE_MSK;
+}
+
+static inline uint8_t stusb4500_regs_rx_num_data_objects(stusb4500_regs_t const* regs) {
+    return STUSB4500_HEADER_NUM_DATA_OBJECTS(stusb4500_regs_rx_header(regs));
+}
+
+// Data object i of the last received message, e.g. a source PDO of a SRC_CAPABILITIES message
+static inline uint32_t stusb4500_regs_rx_data_obj(stusb4500_regs_t const* regs, uint8_t i) {
+    if (i >= STUSB4500_MAX_SRC_PDOS) return 0;
+    return stusb4500_regs_get32(regs, STUSB4500_REG_RX_DATA_OBJ + i * sizeof(uint32_t));
+}
+
+static inline uint8_t stusb4500_regs_num_snk_pdos(stusb4500_regs_t const* regs) {
+    return stusb4500_regs_get(regs, STUSB4500_REG_DPM_PDO_NUMB) & STUSB4500_DPM_PDO_NUMB_MSK;
+}
+
+static inline uint32_t stusb4500_regs_snk_pdo(stusb4500_regs_t const* regs, uint8_t i) {
+    if (i >= STUSB4500_NUM_SNK_PDOS) return 0;
+    return stusb4500_regs_get32(regs, STUSB4500_REG_DPM_SNK_PDO1 + i * sizeof(uint32_t));
+}
+
+static inline uint32_t stusb4500_regs_rdo(stusb4500_regs_t const* regs) {
+    return stusb4500_regs_get32(regs, STUSB4500_REG_RDO_STATUS);
+}
+
+// Requested source PDO position, starting at 1, 0 without a request
+static inline uint8_t stusb4500_regs_rdo_position(stusb4500_regs_t const* regs) {
+    return (stusb4500_regs_rdo(regs) & STUSB4500_RDO_OBJECT_POSITION_MSK) >>
+           STUSB4500_RDO_OBJECT_POSITION_POS;
+}
+
+// Type of a raw source or sink PDO, see stusb4500_pdo_decode() for the other fields
+static inline stusb4500_pdo_type_t stusb4500_regs_pdo_type(uint32_t pdo) {
+    return (stusb4500_pdo_type_t)(pdo >> STUSB4500_PDO_TYPE_POS);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "stusb4500_record.h"
+
+#include <stdio.h>
+
+// Replay of a bus recording, see stusb4500_record.h. A replaying device handle answers every
+// register access with the recorded response, without delays, and checks that the library makes
+// the same requests in the same order. On the first divergence, the replay stops and all further
+// accesses fail.
+
+enum {
+    STUSB4500_REPLAY_OK,
+    // Different access type, e.g. a read where a transfer was recorded
+    STUSB4500_REPLAY_TYPE,
+    // Different number of messages, direction, register or length, or wait timeout
+    STUSB4500_REPLAY_MESSAGE,
+    // Different bytes written
+    STUSB4500_REPLAY_PAYLOAD,
+    // More requests than recorded
+    STUSB4500_REPLAY_END,
+    // Recorded requests left over, see stusb4500_replay_finish()
+    STUSB4500_REPLAY_UNCONSUMED,
+    // Truncated or malformed recording
+    STUSB4500_REPLAY_CORRUPT,
+};
+typedef uint8_t stusb4500_divergence_t;
+
+typedef struct {
+    FILE* file;
+
+    // Results
+    stusb4500_divergence_t divergence;
+    // Index of the diverging record, starting at 0
+    uint32_t diverged_at;
+    // Register of the diverging request and of the recorded one
+    uint8_t expected_reg;
+    uint8_t actual_reg;
+    uint32_t records;
+
+    // Timestamp of the last replayed record
+    uint32_t now_ms;
+} stusb4500_replay_t;
+
+// Read the header and point a device handle at the replay. The handle gets the hooks that were
+// recorded, which return immediately. The replay becomes the one of stusb4500_replay_get_ms()
+bool stusb4500_replay_open(stusb4500_replay_t* replay, FILE* file, stusb4500_t* dev);
+// Recorded clock of the most recently opened replay. Use it wherever stusb4500_record_get_ms()
+// was used while recording
+uint32_t stusb4500_replay_get_ms(void);
+// True if the requests matched the recording up to its end
+bool stusb4500_replay_finish(stusb4500_replay_t* replay);
+
+// Record sink writing to a FILE*
+bool stusb4500_record_file_sink(void const* buf, size_t len, void* context);
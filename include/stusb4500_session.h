@@ -0,0 +1,26 @@
+#pragma once
+
+#include "stusb4500.h"
+
+#include <pthread.h>
+
+// POSIX thread arbitration of a shared I2C bus. Attach the handles of all devices on a bus to one
+// stusb4500_session_bus_t, then use each handle from any thread. Every bus transaction and every
+// sequence which must not be interleaved (an FTP command and its busy wait, the source
+// capabilities detection and capture) holds the bus, but waits in between do not. Short
+// operations from other threads, e.g. stusb4500_set_gpio_state(), run during the waits of a
+// negotiation or between the FTP commands of a flash instead of queueing behind them.
+//
+// The bus lock does not make concurrent negotiations or NVM operations on the same device valid,
+// each device still needs a single owner for those.
+
+typedef struct {
+    pthread_mutex_t mutex;
+    // Number of times the bus was found held by another thread
+    uint32_t contentions;
+} stusb4500_session_bus_t;
+
+bool stusb4500_session_bus_init(stusb4500_session_bus_t* bus);
+void stusb4500_session_bus_destroy(stusb4500_session_bus_t* bus);
+// Arbitrate the bus accesses of a device handle through the bus
+void stusb4500_session_attach(stusb4500_session_bus_t* bus, stusb4500_t* dev);
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "stusb4500.h"
+
+// Register-level software model of the STUSB4500. The model implements the subset of the register
+// map used by the driver, the FTP/NVM controller and a PD source which answers soft resets with a
+// SRC_CAPABILITIES message followed by an Accept. Time is virtual and only advances with bus
+// traffic, so results are deterministic and independent of the host.
+
+#define STUSB4500_SIM_MAX_SRC_PDOS 7UL
+#define STUSB4500_SIM_NVM_SIZE 40UL
+
+// Fixed supply source PDO
+#define STUSB4500_SIM_FIXED_PDO(mv, ma)                                                            \
+    ((((uint32_t)(mv) / 50UL) << 10) | (((uint32_t)(ma) / 10UL) & 0x03FFUL))
+
+typedef struct {
+    // I2C SCL frequency in Hz, 100000 if 0
+    uint32_t bus_clock_hz;
+    // Fixed host-side cost added to every bus transaction (adapter latency, syscalls, ...)
+    uint32_t transaction_overhead_us;
+
+    // Cable attach to first SRC_CAPABILITIES received
+    uint32_t attach_settle_us;
+    // Soft reset sent to the Accept of the soft reset
+    uint32_t soft_reset_accept_us;
+    // Accept of the soft reset to SRC_CAPABILITIES received
+    uint32_t caps_delay_us;
+    // SRC_CAPABILITIES received to Accept received, the race window of the driver
+    uint32_t accept_delay_us;
+    // Accept received to PS_RDY received and PE_SNK_READY
+    uint32_t ready_delay_us;
+    // Number of RX_DATA_OBJ bytes clobbered by the Accept message
+    uint8_t accept_overwrite_bytes;
+
+    // FTP command durations
+    uint32_t ftp_op_us;
+    uint32_t ftp_erase_us;
+    uint32_t ftp_program_us;
+
+    // Source capabilities
+    uint32_t src_pdos[STUSB4500_SIM_MAX_SRC_PDOS];
+    uint8_t num_src_pdos;
+
+    // Cable attached at power up
+    bool attached;
+} stusb4500_sim_config_t;
+
+typedef struct {
+    // Bus transactions, each consisting of one or more register reads and writes
+    uint32_t transactions;
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t bytes_read;
+    uint32_t bytes_written;
+    uint64_t bus_time_us;
+    // RX_DATA_OBJ reads which returned data already clobbered by the Accept message
+    uint32_t late_caps_reads;
+    // Soft resets sent by the sink
+    uint32_t soft_resets;
+    // Calls to stusb4500_sim_wait_alert()
+    uint32_t alert_waits;
+    // Calls to stusb4500_sim_delay() and the time slept
+    uint32_t delays;
+    uint64_t delay_time_us;
+    // Per sector FTP erase and program counts
+    uint32_t sector_erases[5];
+    uint32_t sector_programs[5];
+} stusb4500_sim_stats_t;
+
+typedef struct stusb4500_sim {
+    stusb4500_sim_config_t config;
+    stusb4500_sim_stats_t stats;
+    uint64_t now_us;
+    uint64_t bus_bits;
+
+    uint8_t regs[256];
+    uint8_t nvm[STUSB4500_SIM_NVM_SIZE];
+
+    // FTP controller
+    uint8_t ftp_pl[8];
+    uint8_t ftp_ser;
+    uint8_t ftp_opcode;
+    uint8_t ftp_sector;
+    bool ftp_busy;
+    uint64_t ftp_done_us;
+
+    // PD source
+    uint8_t pd_phase;
+    uint64_t pd_event_us;
+    bool caps_clobbered;
+    uint8_t msg_id;
+
+    // Next device on the same bus, see stusb4500_sim_share_bus()
+    struct stusb4500_sim* next_on_bus;
+} stusb4500_sim_t;
+
+// Fill a configuration with timings resembling a typical 100 kHz setup and a 5V/9V/15V/20V source
+void stusb4500_sim_default_config(stusb4500_sim_config_t* config);
+// Power up the model with the factory NVM image. The simulator becomes the time base of
+// stusb4500_sim_get_ms()
+void stusb4500_sim_init(stusb4500_sim_t* sim, stusb4500_sim_config_t const* config);
+// Point a device handle at the simulator. Clear dev->transfer afterwards to model a bus without
+// combined transfers, clear dev->delay to poll back to back, set dev->wait_alert to
+// stusb4500_sim_wait_alert() to use the ALERT pin
+void stusb4500_sim_bind(stusb4500_sim_t* sim, stusb4500_t* dev);
+
+bool stusb4500_sim_read(uint16_t addr, uint8_t reg, void* buf, size_t len, void* context);
+bool stusb4500_sim_write(uint16_t addr, uint8_t reg, void const* buf, size_t len, void* context);
+bool stusb4500_sim_transfer(
+  uint16_t addr, stusb4500_msg_t const* msgs, size_t num_msgs, void* context);
+
+// Model of the ALERT pin, usable as stusb4500_t.wait_alert with the simulator as context
+bool stusb4500_sim_wait_alert(uint32_t timeout_ms, void* context);
+bool stusb4500_sim_alert_asserted(stusb4500_sim_t const* sim);
+
+// Sleep in virtual time, usable as stusb4500_t.delay with the simulator as context
+void stusb4500_sim_delay(uint32_t us, void* context);
+
+// Advance virtual time without bus traffic
+void stusb4500_sim_advance_us(stusb4500_sim_t* sim, uint64_t us);
+// Put initialized simulators on one bus. Traffic to any of them then advances the time of all, so
+// the duration of interleaved operations can be measured. Per-device stats are kept separate
+void stusb4500_sim_share_bus(stusb4500_sim_t* const* sims, size_t num_sims);
+// Plug or unplug the cable. Plugging in restarts the contract negotiation with the source
+void stusb4500_sim_set_attached(stusb4500_sim_t* sim, bool attached);
+// Virtual time of the most recently initialized simulator, usable as stusb4500_config_t.get_ms
+uint32_t stusb4500_sim_get_ms(void);
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "stusb4500.h"
+
+// Binary trace of the PDO selection. With STUSB4500_TRACE defined and a trace attached to the
+// device handle, the negotiation stores fixed-size records in a ring buffer instead of formatting
+// STUSB4500_LOG lines. The records can be drained from another context while the negotiation runs,
+// or dumped as raw bytes and rendered later with stusb4500_trace_format().
+
+enum {
+    // A source PDO. index: object position, value: raw PDO
+    STUSB4500_TRACE_SRC_PDO = 1UL,
+    // Selection constraints. value: minimum voltage (low 16 bits) and maximum voltage (high 16
+    // bits) in mV, aux: minimum current in mA
+    STUSB4500_TRACE_CONSTRAINTS = 2UL,
+    // Chosen PDO. index: object position, value: voltage (low 16 bits) in mV and current (high 16
+    // bits) in mA
+    STUSB4500_TRACE_SELECTED = 3UL,
+    // No suitable PDO
+    STUSB4500_TRACE_NO_PDO = 4UL,
+};
+typedef uint8_t stusb4500_trace_event_t;
+
+// 12 bytes without padding, the in-memory layout is the dump format on little endian hosts
+typedef struct {
+    stusb4500_trace_event_t event;
+    uint8_t index;
+    uint16_t aux;
+    uint32_t value;
+    uint32_t timestamp_ms;
+} stusb4500_trace_record_t;
+
+// Lock-free single producer, single consumer ring buffer. Records are dropped if it is full
+typedef struct stusb4500_trace {
+    stusb4500_trace_record_t* records;
+    // Power of two
+    uint32_t capacity;
+    // Written by the producer only
+    uint32_t head;
+    uint32_t dropped;
+    // Written by the consumer only
+    uint32_t tail;
+} stusb4500_trace_t;
+
+// Returns false if capacity is not a power of two
+bool stusb4500_trace_init(
+  stusb4500_trace_t* trace, stusb4500_trace_record_t* records, uint32_t capacity);
+bool stusb4500_trace_push(stusb4500_trace_t* trace, stusb4500_trace_record_t const* record);
+bool stusb4500_trace_pop(stusb4500_trace_t* trace, stusb4500_trace_record_t* record);
+
+// Render a record as the STUSB4500_LOG lines it replaces. Returns the length of the text, which is
+// truncated if it does not fit, see snprintf(). Host side only, part of the stusb4500_trace_format
+// library
+int stusb4500_trace_format(stusb4500_trace_record_t const* record, char* buf, size_t size);
@@ -1,6 +1,16 @@
 #include "stusb4500.h"
+#include "stusb4500_backoff.h"
+#include "stusb4500_bus.h"
+#include "stusb4500_defs.h"
+#include "stusb4500_metrics.h"
+#include "stusb4500_pdo.h"
+#include "stusb4500_trace.h"
+
+#include <string.h>
 
 // STUSB4500 registers
+#define STUSB_ALERT_STATUS_1 0x0BUL
+#define STUSB_ALERT_STATUS_1_MASK 0x0CUL
 #define STUSB_PORT_STATUS 0x0EUL
 #define STUSB_PRT_STATUS 0x16UL
 #define STUSB_CMD_CTRL 0x1AUL
@@ -11,8 +21,12 @@
 #define STUSB_RX_BYTE_CNT 0x30UL
 #define STUSB_RX_HEADER 0x31UL
 #define STUSB_RX_DATA_OBJ 0x33UL
+#define STUSB_RX_DATA_OBJ_END 0x4FUL
 #define STUSB_TX_HEADER 0x51UL
+#define STUSB_DPM_PDO_NUMB 0x70UL
 #define STUSB_DPM_SNK_PDO1 0x85UL
+#define STUSB_DPM_SNK_PDO3 0x8DUL
+#define STUSB_RDO_STATUS 0x91UL
 
 // STUSB4500 masks/constants
 #define STUSB4500_ID 0x25UL
@@ -23,9 +37,8 @@
 #define STUSB_PRT_MESSAGE_RECEIVED 0x04UL
 #define STUSB_SRC_CAPABILITIES_MSG 0x01UL
 #define STUSB_PE_SNK_READY 0x18UL
-
-// Maximum number of source power profiles
-#define MAX_SRC_PDOS 10UL
+#define STUSB_ALERT_MASK_ALL 0xFFUL
+#define STUSB_DPM_PDO_NUMB_MSK 0x07UL
 
 // PD protocol commands, see USB PD spec Table 6-3
 #define PD_CMD 0x26UL
@@ -44,125 +57,116 @@
 #define HEADER_NUM_DATA_OBJECTS(header)                                                            \
     (((header)&HEADER_NUM_DATA_OBJECTS_MSK) >> HEADER_NUM_DATA_OBJECTS_POS)
 
-// See USB PD spec Section 7.1.3 and STUSB4500 Section 5.2 Table 16
-#define PDO_TYPE_POS 30UL
-#define PDO_TYPE_MSK (0x03UL << PDO_TYPE_POS)
-#define PDO_TYPE(pdo) (((pdo)&PDO_TYPE_MSK) >> PDO_TYPE_POS)
-#define PDO_TYPE_FIXED 0x00UL
-
-#define PDO_CURRENT_POS 0UL
-#define PDO_CURRENT_MSK (0x03FFUL << PDO_CURRENT_POS)
-#define PDO_CURRENT_RESOLUTION 10UL
-#define FROM_PDO_CURRENT(pdo)                                                                      \
-    ((((pdo)&PDO_CURRENT_MSK) >> PDO_CURRENT_POS) * PDO_CURRENT_RESOLUTION)
-#define TO_PDO_CURRENT(ma) ((((ma) / PDO_CURRENT_RESOLUTION) << PDO_CURRENT_POS) & PDO_CURRENT_MSK)
-
-#define PDO_VOLTAGE_POS 10UL
-#define PDO_VOLTAGE_MSK (0x03FFUL << PDO_VOLTAGE_POS)
-#define PDO_VOLTAGE_RESOLUTION 50UL
-#define FROM_PDO_VOLTAGE(pdo)                                                                      \
-    ((((pdo)&PDO_VOLTAGE_MSK) >> PDO_VOLTAGE_POS) * PDO_VOLTAGE_RESOLUTION)
-#define TO_PDO_VOLTAGE(mv) ((((mv) / PDO_VOLTAGE_RESOLUTION) << PDO_VOLTAGE_POS) & PDO_VOLTAGE_MSK)
-
-#define TIMEOUT_MS 500UL
-
-typedef uint32_t stusb4500_power_t;
-typedef uint32_t stusb4500_pdo_t;
-typedef uint8_t stusb4500_pd_state_t;
+// See USB PD spec Section 6.4.2
+#define RDO_OBJECT_POSITION_POS 28UL
+#define RDO_OBJECT_POSITION_MSK (0x07UL << RDO_OBJECT_POSITION_POS)
+#define RDO_OBJECT_POSITION(rdo) (((rdo)&RDO_OBJECT_POSITION_MSK) >> RDO_OBJECT_POSITION_POS)
 
-// PD_SOFT_RESET seems to be the only message the STUSB4500 supports
-static bool send_pd_message(stusb4500_t const* dev, uint16_t msg) {
-    uint8_t cmd = PD_CMD;
-    return dev->write(dev->addr, STUSB_TX_HEADER, &msg, sizeof(uint16_t), dev->context) &&
-           dev->write(dev->addr, STUSB_CMD_CTRL, &cmd, 1, dev->context);
-}
+// Layout of the RX_BYTE_CNT to RX_DATA_OBJ burst
+#define RX_BYTE_CNT_OFFSET 0UL
+#define RX_HEADER_OFFSET (STUSB_RX_HEADER - STUSB_RX_BYTE_CNT)
+#define RX_DATA_OBJ_OFFSET (STUSB_RX_DATA_OBJ - STUSB_RX_BYTE_CNT)
+#define RX_CAPTURE_SIZE (STUSB_RX_DATA_OBJ_END - STUSB_RX_BYTE_CNT)
 
-static bool is_present(stusb4500_t const* dev) {
-    uint8_t res;
-    if (!dev->read(dev->addr, STUSB_WHO_AM_I, &res, 1, dev->context)) return false;
+// Layout of the ALERT_STATUS_1 to PRT_STATUS burst, reading it clears all alerts
+#define ALERT_BLOCK_SIZE (STUSB_PRT_STATUS - STUSB_ALERT_STATUS_1 + 1UL)
+#define ALERT_BLOCK_PORT_STATUS (STUSB_PORT_STATUS - STUSB_ALERT_STATUS_1)
+#define ALERT_BLOCK_PRT_STATUS (STUSB_PRT_STATUS - STUSB_ALERT_STATUS_1)
 
-    return (res == STUSB4500_ID || res == STUSB4500B_ID);
-}
+// Layout of the DPM_SNK_PDO1 to RDO_STATUS burst
+#define SNK_PDOS_SIZE (STUSB4500_NUM_SNK_PDOS * sizeof(stusb4500_pdo_t))
+#define SNK_PDOS_RDO_OFFSET (STUSB_RDO_STATUS - STUSB_DPM_SNK_PDO1)
 
-static bool
-  wait_until_ready_with_timeout(stusb4500_t const* dev, stusb4500_config_t const* config) {
-    stusb4500_pd_state_t pd_state;
-    uint32_t start = 0;
+// 32-bit FNV-1a
+#define FNV_OFFSET_BASIS 0x811C9DC5UL
+#define FNV_PRIME 0x01000193UL
 
-    if (config->get_ms) {
-        start = config->get_ms();
-    }
+typedef uint8_t stusb4500_pd_state_t;
 
-    do {
-        if (config->get_ms && (config->get_ms() - start > TIMEOUT_MS)) return false;
-        if (!dev->read(dev->addr, STUSB_PE_FSM, &pd_state, 1, dev->context)) return false;
-    } while (pd_state != STUSB_PE_SNK_READY);
+static bool is_present(stusb4500_t const* dev) {
+    uint8_t res;
+    if (!stusb4500_read(dev, STUSB_WHO_AM_I, &res, 1)) return false;
 
-    return true;
+    return (res == STUSB4500_ID || res == STUSB4500B_ID);
 }
 
-static bool write_pdo(
-  stusb4500_t const* dev,
-  stusb4500_current_t current_ma,
-  stusb4500_voltage_t voltage_mv,
-  uint8_t pdo_num) {
+static bool write_pdo(stusb4500_t const* dev, stusb4500_pdo_t pdo, uint8_t pdo_num) {
     if (pdo_num < 1 || pdo_num > 3) return false;
 
-    // Format the sink PDO
-    stusb4500_pdo_t pdo = TO_PDO_CURRENT(current_ma) | TO_PDO_VOLTAGE(voltage_mv);
-
     // Write the sink PDO
-    return dev->write(
-      dev->addr,
+    return stusb4500_write(
+      dev,
       STUSB_DPM_SNK_PDO1 + sizeof(stusb4500_pdo_t) * (pdo_num - 1),
       &pdo,
-      sizeof(stusb4500_pdo_t),
-      dev->context);
+      sizeof(stusb4500_pdo_t));
 }
 
-static bool load_optimal_pdo(
-  stusb4500_t const* dev,
-  stusb4500_config_t const* config,
-  stusb4500_pdo_t const* src_pdos,
-  uint8_t num_pdos) {
-    bool found = false;
-
-    stusb4500_current_t opt_pdo_current = config->min_current_ma;
-    stusb4500_voltage_t opt_pdo_voltage = config->min_voltage_mv;
-    stusb4500_power_t opt_pdo_power =
-      (stusb4500_power_t)opt_pdo_voltage * (stusb4500_power_t)opt_pdo_current / 1000UL;
-
-    // Search for the optimal PDO, if any
-    for (int i = 0; i < num_pdos; i++) {
-        stusb4500_pdo_t const pdo = src_pdos[i];
-
-        // Extract PDO parameters
-        stusb4500_current_t pdo_current = FROM_PDO_CURRENT(pdo);
-        stusb4500_voltage_t pdo_voltage = FROM_PDO_VOLTAGE(pdo);
-        stusb4500_power_t pdo_power =
-          (stusb4500_power_t)pdo_current * (stusb4500_power_t)pdo_voltage / 1000UL;
-
-        STUSB4500_LOG(
-          "Detected Source PDO: %2d.%03dV, %d.%03dA, %3d.%03dW\r\n",
-          (int)(pdo_voltage / 1000UL),
-          (int)(pdo_voltage % 1000UL),
-          (int)(pdo_current / 1000UL),
-          (int)(pdo_current % 1000UL),
-          (int)((stusb4500_power_t)pdo_power / 1000UL),
-          (int)((stusb4500_power_t)pdo_power % 1000UL));
-
-        if (
-          PDO_TYPE(pdo) != PDO_TYPE_FIXED || pdo_current < config->min_current_ma ||
-          pdo_voltage < config->min_voltage_mv || pdo_voltage > config->max_voltage_mv)
+#ifdef STUSB4500_TRACE
+static void trace(
+  stusb4500_negotiation_t const* ctx,
+  stusb4500_trace_event_t event,
+  uint8_t index,
+  uint16_t aux,
+  uint32_t value) {
+    stusb4500_trace_record_t record;
+
+    if (!ctx->dev->trace) return;
+
+    record.event = event;
+    record.index = index;
+    record.aux = aux;
+    record.value = value;
+    record.timestamp_ms = ctx->config->get_ms ? ctx->config->get_ms() : 0;
+    stusb4500_trace_push(ctx->dev->trace, &record);
+}
+#endif // STUSB4500_TRACE
+
+static void log_src_pdos(stusb4500_negotiation_t const* ctx) {
+    for (uint8_t i = 0; i < ctx->num_src_pdos; i++) {
+#ifdef STUSB4500_TRACE
+        trace(ctx, STUSB4500_TRACE_SRC_PDO, i + 1, 0, ctx->src_pdos[i]);
+#else  // STUSB4500_TRACE
+        stusb4500_src_pdo_t pdo;
+        if (!stusb4500_pdo_decode(ctx->src_pdos[i], &pdo)) {
+            STUSB4500_LOG("Detected Source PDO: unsupported\r\n");
             continue;
-        if (pdo_power > opt_pdo_power) {
-            opt_pdo_current = pdo_current;
-            opt_pdo_voltage = pdo_voltage;
-            opt_pdo_power = pdo_power;
-            found = true;
         }
+
+        STUSB4500_LOG(
+          "Detected Source PDO: %2d.%03dV - %2d.%03dV, %d.%03dA, %3d.%03dW\r\n",
+          (int)(pdo.min_voltage_mv / 1000UL),
+          (int)(pdo.min_voltage_mv % 1000UL),
+          (int)(pdo.max_voltage_mv / 1000UL),
+          (int)(pdo.max_voltage_mv % 1000UL),
+          (int)(pdo.max_current_ma / 1000UL),
+          (int)(pdo.max_current_ma % 1000UL),
+          (int)(pdo.max_power_mw / 1000UL),
+          (int)(pdo.max_power_mw % 1000UL));
+#endif // STUSB4500_TRACE
     }
+}
 
+static void log_selection(stusb4500_negotiation_t const* ctx, stusb4500_candidate_t const* opt) {
+    stusb4500_config_t const* config = ctx->config;
+
+#ifdef STUSB4500_TRACE
+    trace(
+      ctx,
+      STUSB4500_TRACE_CONSTRAINTS,
+      0,
+      (uint16_t)config->min_current_ma,
+      (config->min_voltage_mv & 0xFFFFUL) | ((uint32_t)config->max_voltage_mv << 16));
+    if (opt) {
+        trace(
+          ctx,
+          STUSB4500_TRACE_SELECTED,
+          opt->position,
+          0,
+          (opt->voltage_mv & 0xFFFFUL) | ((uint32_t)opt->current_ma << 16));
+    } else {
+        trace(ctx, STUSB4500_TRACE_NO_PDO, 0, 0, 0);
+    }
+#else  // STUSB4500_TRACE
     STUSB4500_LOG(
       "\r\nSelecting optimal PDO based on user parameters: %d.%03dV - %d.%03dV, >= "
       "%d.%03dA\r\n",
@@ -172,103 +176,689 @@ static bool load_optimal_pdo(
       (int)(config->max_voltage_mv % 1000UL),
       (int)(config->min_current_ma / 1000UL),
       (int)(config->min_current_ma % 1000UL));
-    if (found) {
+    if (opt) {
         STUSB4500_LOG(
           "Selected PDO: %d.%03dV, %d.%03dA, %d.%03dW\r\n\r\n",
-          (int)(opt_pdo_voltage / 1000UL),
-          (int)(opt_pdo_voltage % 1000UL),
-          (int)(opt_pdo_current / 1000UL),
-          (int)(opt_pdo_current % 1000UL),
-          (int)((stusb4500_power_t)opt_pdo_power / 1000UL),
-          (int)((stusb4500_power_t)opt_pdo_power % 1000UL));
+          (int)(opt->voltage_mv / 1000UL),
+          (int)(opt->voltage_mv % 1000UL),
+          (int)(opt->current_ma / 1000UL),
+          (int)(opt->current_ma % 1000UL),
+          (int)(opt->power_mw / 1000UL),
+          (int)(opt->power_mw % 1000UL));
     } else {
         STUSB4500_LOG("No suitable PDO found\r\n\r\n");
-        return false;
     }
+#endif // STUSB4500_TRACE
+}
+
+static bool find_optimal_pdo(stusb4500_negotiation_t* ctx) {
+    stusb4500_config_t const* config = ctx->config;
+    stusb4500_candidate_t const* opt = NULL;
+
+    log_src_pdos(ctx);
+
+    // Rank the PDOs, the best one the STUSB4500 can request wins
+    ctx->num_candidates = stusb4500_pdo_rank(
+      config, ctx->src_pdos, ctx->num_src_pdos, ctx->candidates, STUSB4500_MAX_SRC_PDOS);
+    for (uint8_t i = 0; i < ctx->num_candidates && !opt; i++) {
+        if (ctx->candidates[i].requestable) opt = &ctx->candidates[i];
+    }
+
+    log_selection(ctx, opt);
+    if (!opt) return false;
 
-    // Push the new PDO
-    if (!write_pdo(dev, opt_pdo_current, opt_pdo_voltage, 3)) return false;
+    // Format the sink PDO
+    ctx->snk_pdo = TO_PDO_CURRENT(opt->current_ma) | TO_PDO_VOLTAGE(opt->voltage_mv);
 
     return true;
 }
 
-bool stusb4500_negotiate(
-  stusb4500_t const* dev, stusb4500_config_t const* config, bool on_interrupt) {
-    uint8_t buffer[MAX_SRC_PDOS * sizeof(stusb4500_pdo_t)];
-    uint16_t header;
-    uint32_t start = 0;
+static uint32_t fnv_word(uint32_t hash, uint32_t word) {
+    for (uint8_t byte = 0; byte < sizeof(word); byte++) {
+        hash = (hash ^ ((word >> (8 * byte)) & 0xFFUL)) * FNV_PRIME;
+    }
 
-    if (!config) return false;
+    return hash;
+}
 
-    // Sanity check to see if STUSB4500 is there
-    if (!is_present(dev)) return false;
+// FNV-1a hash of the source capabilities and everything else which decides the choice: the
+// constraints, the policy and whether fallback PDOs are loaded
+static uint32_t fingerprint(
+  stusb4500_config_t const* config, stusb4500_pdo_t const* src_pdos, uint8_t num_pdos) {
+    stusb4500_policy_t const* policy = config->policy;
+    uint32_t const words[] = {
+      config->min_current_ma,
+      config->min_voltage_mv,
+      config->max_voltage_mv,
+      config->load_all_pdos,
+      policy != NULL,
+      policy ? policy->target_voltage_mv : 0,
+      (policy && policy->terms) ? policy->num_terms : 0,
+    };
+    uint32_t hash = FNV_OFFSET_BASIS;
+
+    for (uint8_t i = 0; i < num_pdos; i++) {
+        hash = fnv_word(hash, src_pdos[i]);
+    }
+    for (uint8_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        hash = fnv_word(hash, words[i]);
+    }
+    for (uint8_t i = 0; policy && policy->terms && i < policy->num_terms; i++) {
+        hash = fnv_word(
+          hash, policy->terms[i].criterion | ((uint32_t)(uint16_t)policy->terms[i].weight << 8));
+    }
 
-    // Check that cable is attached
-    if (
-      !dev->read(dev->addr, STUSB_PORT_STATUS, buffer, 1, dev->context) ||
-      !(buffer[0] & STUSB_ATTACH))
+    // 0 marks an empty cache entry
+    return hash ? hash : 1;
+}
+
+// Move entry i to the front, entries are kept in most recently used order
+static void cache_promote(stusb4500_pdo_cache_t* cache, uint8_t i) {
+    stusb4500_pdo_cache_entry_t entry = cache->entries[i];
+
+    memmove(&cache->entries[1], &cache->entries[0], i * sizeof(entry));
+    cache->entries[0] = entry;
+}
+
+static bool cache_lookup(stusb4500_pdo_cache_t* cache, uint32_t key, stusb4500_pdo_t* snk_pdo) {
+    if (!cache || !cache->entries) return false;
+
+    for (uint8_t i = 0; i < cache->num_entries; i++) {
+        if (cache->entries[i].fingerprint != key) continue;
+
+        *snk_pdo = cache->entries[i].snk_pdo;
+        cache_promote(cache, i);
+        return true;
+    }
+
+    return false;
+}
+
+static void cache_insert(stusb4500_pdo_cache_t* cache, uint32_t key, stusb4500_pdo_t snk_pdo) {
+    if (!cache || !cache->entries || !cache->num_entries) return;
+
+    // Evict the least recently used entry
+    cache->entries[cache->num_entries - 1].fingerprint = key;
+    cache->entries[cache->num_entries - 1].snk_pdo = snk_pdo;
+    cache_promote(cache, cache->num_entries - 1);
+}
+
+// Most recently used choice, the best guess for the source that is plugged in. It may have been
+// chosen under other constraints, so it is only used if it satisfies the current ones
+static bool cache_predict(stusb4500_config_t const* config, stusb4500_pdo_t* snk_pdo) {
+    stusb4500_pdo_cache_t const* cache = config->cache;
+
+    if (!cache || !cache->entries || !cache->num_entries || !cache->entries[0].fingerprint)
         return false;
 
-    // Force transmission of source capabilities if not responding to an STUSB_ATTACH interrupt
-    if (!on_interrupt) {
-        if (!wait_until_ready_with_timeout(dev, config)) return false;
-        if (!send_pd_message(dev, PD_SOFT_RESET)) return false;
+    stusb4500_pdo_t const pdo = cache->entries[0].snk_pdo;
+    uint32_t const voltage_mv = FROM_PDO_VOLTAGE(pdo);
+    if (voltage_mv < config->min_voltage_mv || voltage_mv > config->max_voltage_mv) return false;
+    if (FROM_PDO_CURRENT(pdo) < config->min_current_ma) return false;
+
+    *snk_pdo = pdo;
+    return true;
+}
+
+// Negotiation states, see stusb4500_negotiate_poll()
+enum {
+    NEGOTIATE_CHECK_PRESENT,
+    NEGOTIATE_CHECK_ATTACHED,
+    NEGOTIATE_WAIT_READY,
+    NEGOTIATE_PREDICT_PDO,
+    NEGOTIATE_SEND_SOFT_RESET_HEADER,
+    NEGOTIATE_SEND_SOFT_RESET_CMD,
+    NEGOTIATE_WAIT_MESSAGE,
+    NEGOTIATE_CAPTURE,
+    NEGOTIATE_CHECK_CONTRACT,
+    NEGOTIATE_LOAD_PDO,
+    NEGOTIATE_FINISHED,
+    NEGOTIATE_UNCHANGED,
+    NEGOTIATE_DETACHED,
+    NEGOTIATE_FAILED,
+};
+
+static void start_wait(stusb4500_negotiation_t* ctx, uint32_t max_delay_us) {
+    stusb4500_backoff_start(
+      &ctx->backoff, ctx->config->get_ms, ctx->config->timeout_ms, max_delay_us);
+}
+
+// Read PRT_STATUS and the attach state. In ALERT mode the alert status registers are read along
+// with them to release the ALERT pin, otherwise the next wait for ALERT would return immediately
+static bool read_prt_status(
+  stusb4500_t const* dev, uint8_t* buffer, uint8_t* port_status, uint8_t* prt_status) {
+    if (!dev->wait_alert) {
+        stusb4500_msg_t const msgs[] = {
+          STUSB4500_READ_MSG(STUSB_PORT_STATUS, port_status, 1),
+          STUSB4500_READ_MSG(STUSB_PRT_STATUS, prt_status, 1),
+        };
+        return stusb4500_transfer(dev, msgs, STUSB4500_NUM_MSGS(msgs));
+    }
+
+    if (!stusb4500_read(dev, STUSB_ALERT_STATUS_1, buffer, ALERT_BLOCK_SIZE))
+        return false;
+
+    *port_status = buffer[ALERT_BLOCK_PORT_STATUS];
+    *prt_status = buffer[ALERT_BLOCK_PRT_STATUS];
+    return true;
+}
+
+// Read the policy engine state and the attach state
+static bool read_pe_state(
+  stusb4500_t const* dev,
+  uint8_t* buffer,
+  uint8_t* port_status,
+  stusb4500_pd_state_t* state) {
+    if (!dev->wait_alert) {
+        stusb4500_msg_t const msgs[] = {
+          STUSB4500_READ_MSG(STUSB_PORT_STATUS, port_status, 1),
+          STUSB4500_READ_MSG(STUSB_PE_FSM, state, 1),
+        };
+        return stusb4500_transfer(dev, msgs, STUSB4500_NUM_MSGS(msgs));
+    }
+
+    stusb4500_msg_t const msgs[] = {
+      STUSB4500_READ_MSG(STUSB_ALERT_STATUS_1, buffer, ALERT_BLOCK_SIZE),
+      STUSB4500_READ_MSG(STUSB_PE_FSM, state, 1),
+    };
+    if (!stusb4500_transfer(dev, msgs, STUSB4500_NUM_MSGS(msgs))) return false;
+
+    *port_status = buffer[ALERT_BLOCK_PORT_STATUS];
+    return true;
+}
+
+// Wait for PE_SNK_READY, then continue with the given state
+static void wait_until_ready(stusb4500_negotiation_t* ctx, uint8_t next_state) {
+    start_wait(ctx, STUSB4500_READY_MAX_DELAY_US);
+    ctx->next_state = next_state;
+    ctx->state = NEGOTIATE_WAIT_READY;
+}
+
+// True if sink PDO3 holds the chosen PDO and the active RDO requests a source PDO at its voltage
+static bool
+  is_contract_active(stusb4500_negotiation_t const* ctx, stusb4500_pdo_t snk_pdo3, uint32_t rdo) {
+    uint8_t const pos = RDO_OBJECT_POSITION(rdo);
+    stusb4500_pdo_t const msk = PDO_CURRENT_MSK | PDO_VOLTAGE_MSK;
+
+    if ((snk_pdo3 & msk) != (ctx->snk_pdo & msk)) return false;
+    if (pos < 1 || pos > ctx->num_src_pdos) return false;
+
+    stusb4500_pdo_t const src_pdo = ctx->src_pdos[pos - 1];
+    return PDO_TYPE(src_pdo) == PDO_TYPE_FIXED &&
+           FROM_PDO_VOLTAGE(src_pdo) == FROM_PDO_VOLTAGE(ctx->snk_pdo);
+}
+
+// Put the cached or searched optimal PDO in place of the optimum of the derived sink set. PDO1
+// stays vSafe5V and the fallbacks below it by voltage
+static void keep_optimal_pdo(stusb4500_negotiation_t* ctx) {
+    uint32_t const voltage_mv = FROM_PDO_VOLTAGE(ctx->snk_pdo);
+    uint8_t num_snk_pdos = ctx->num_snk_pdos - 1;
+
+    if (voltage_mv == VSAFE5V_MV) {
+        num_snk_pdos = 0;
+    } else {
+        if (!num_snk_pdos) num_snk_pdos = 1;
+        while (
+          num_snk_pdos > 1 && FROM_PDO_VOLTAGE(ctx->snk_pdos[num_snk_pdos - 1]) >= voltage_mv)
+            num_snk_pdos--;
     }
 
-    if (config->get_ms) {
-        start = config->get_ms();
+    ctx->snk_pdos[num_snk_pdos++] = ctx->snk_pdo;
+    ctx->num_snk_pdos = num_snk_pdos;
+}
+
+// True if the sink PDOs hold the chosen set. buffer holds DPM_PDO_NUMB followed by the
+// DPM_SNK_PDO1 to DPM_SNK_PDO3 burst
+static bool is_snk_set_loaded(stusb4500_negotiation_t const* ctx, uint8_t const* buffer) {
+    stusb4500_pdo_t const msk = PDO_CURRENT_MSK | PDO_VOLTAGE_MSK;
+    stusb4500_pdo_t snk_pdo;
+
+    if ((buffer[0] & STUSB_DPM_PDO_NUMB_MSK) != ctx->num_snk_pdos) return false;
+
+    for (uint8_t i = 0; i < ctx->num_snk_pdos; i++) {
+        memcpy(&snk_pdo, &buffer[1 + i * sizeof(snk_pdo)], sizeof(snk_pdo));
+        if ((snk_pdo & msk) != (ctx->snk_pdos[i] & msk)) return false;
     }
 
-    while (1) {
+    return true;
+}
+
+static stusb4500_negotiate_status_t step(stusb4500_negotiation_t* ctx) {
+    stusb4500_t const* dev = ctx->dev;
+    stusb4500_pd_state_t pd_state;
+    stusb4500_pdo_t predicted_pdo;
+    stusb4500_pdo_t snk_pdo3;
+    uint32_t rdo;
+    bool loaded;
+    uint8_t port_status;
+    uint8_t prt_status;
+    uint16_t const msg = PD_SOFT_RESET;
+    uint8_t const cmd = PD_CMD;
+
+    ctx->waiting = false;
+
+    switch (ctx->state) {
+    case NEGOTIATE_CHECK_PRESENT:
+        // Sanity check to see if STUSB4500 is there
+        if (!is_present(dev)) return STUSB4500_NEGOTIATE_ERROR;
+        ctx->state = NEGOTIATE_CHECK_ATTACHED;
+        break;
+
+    case NEGOTIATE_CHECK_ATTACHED:
+        // Check that cable is attached
+        if (!stusb4500_read(dev, STUSB_PORT_STATUS, &port_status, 1))
+            return STUSB4500_NEGOTIATE_ERROR;
+        if (!(port_status & STUSB_ATTACH)) {
+            ctx->state = NEGOTIATE_DETACHED;
+            break;
+        }
+
+        // Force transmission of source capabilities if not responding to an STUSB_ATTACH
+        // interrupt
+        if (ctx->on_interrupt) {
+            start_wait(ctx, STUSB4500_MESSAGE_MAX_DELAY_US);
+            ctx->state = NEGOTIATE_WAIT_MESSAGE;
+        } else if (cache_predict(ctx->config, &ctx->snk_pdo)) {
+            wait_until_ready(ctx, NEGOTIATE_PREDICT_PDO);
+        } else {
+            wait_until_ready(ctx, NEGOTIATE_SEND_SOFT_RESET_HEADER);
+        }
+        break;
+
+    case NEGOTIATE_PREDICT_PDO:
+        // Load the choice for the most recently seen source before the soft reset. If that source
+        // is plugged in, the contract negotiated after the soft reset is already optimal
+        if (!write_pdo(dev, ctx->snk_pdo, 3)) return STUSB4500_NEGOTIATE_ERROR;
+        ctx->predicted = true;
+        ctx->state = NEGOTIATE_SEND_SOFT_RESET_HEADER;
+        break;
+
+    case NEGOTIATE_WAIT_READY:
+        if (!stusb4500_backoff_poll(&ctx->backoff)) return STUSB4500_NEGOTIATE_ERROR;
+        if (!read_pe_state(dev, ctx->buffer, &port_status, &pd_state))
+            return STUSB4500_NEGOTIATE_ERROR;
+
+        // Give up right away if the cable was pulled, PE_SNK_READY will not come
+        if (!(port_status & STUSB_ATTACH)) {
+            ctx->state = NEGOTIATE_DETACHED;
+            break;
+        }
+
+        ctx->waiting = (pd_state != STUSB_PE_SNK_READY);
+        if (!ctx->waiting) ctx->state = ctx->next_state;
+        break;
+
+    // PD_SOFT_RESET seems to be the only message the STUSB4500 supports
+    case NEGOTIATE_SEND_SOFT_RESET_HEADER:
+        if (!stusb4500_write(dev, STUSB_TX_HEADER, &msg, sizeof(uint16_t)))
+            return STUSB4500_NEGOTIATE_ERROR;
+        ctx->state = NEGOTIATE_SEND_SOFT_RESET_CMD;
+        break;
+
+    case NEGOTIATE_SEND_SOFT_RESET_CMD:
+        if (!stusb4500_write(dev, STUSB_CMD_CTRL, &cmd, 1))
+            return STUSB4500_NEGOTIATE_ERROR;
+
+        // The second soft reset forces the renegotiation with the new PDO
+        if (ctx->pdo_loaded) {
+            ctx->state = NEGOTIATE_FINISHED;
+        } else {
+            start_wait(ctx, STUSB4500_MESSAGE_MAX_DELAY_US);
+            ctx->state = NEGOTIATE_WAIT_MESSAGE;
+        }
+        break;
+
+    case NEGOTIATE_WAIT_MESSAGE:
         // Check for timeout
-        if (config->get_ms && (config->get_ms() - start > TIMEOUT_MS)) return false;
+        if (!stusb4500_backoff_poll(&ctx->backoff)) return STUSB4500_NEGOTIATE_ERROR;
+
+        // Hold the bus from the status read which finds the message until the capture, see
+        // stusb4500_negotiate_poll()
+        stusb4500_lock(dev);
+        ctx->capture_locked = true;
 
         // Read the port status to look for a source capabilities message
-        if (!dev->read(dev->addr, STUSB_PRT_STATUS, buffer, 1, dev->context)) return false;
+        if (!read_prt_status(dev, ctx->buffer, &port_status, &prt_status))
+            return STUSB4500_NEGOTIATE_ERROR;
+
+        // No source capabilities will come from a detached source
+        if (!(port_status & STUSB_ATTACH)) {
+            ctx->state = NEGOTIATE_DETACHED;
+            break;
+        }
 
-        // Message has not arrived yet
-        if (!(buffer[0] & STUSB_PRT_MESSAGE_RECEIVED)) continue;
+        // Keep waiting until a message has arrived
+        ctx->waiting = !(prt_status & STUSB_PRT_MESSAGE_RECEIVED);
+        if (!ctx->waiting) ctx->state = NEGOTIATE_CAPTURE;
+        break;
+
+    case NEGOTIATE_CAPTURE:
+        // Capture byte count, header and source capabilities in one burst. The registers are
+        // contiguous and the data objects come first in the burst after the header.
+        // WARNING: This must happen very soon after the message is detected. The source will
+        // send an accept message which partially overwrites the source capabilities message.
+        if (!stusb4500_read(dev, STUSB_RX_BYTE_CNT, ctx->buffer, RX_CAPTURE_SIZE))
+            return STUSB4500_NEGOTIATE_ERROR;
 
-        // Read message header
-        if (!dev->read(dev->addr, STUSB_RX_HEADER, &header, sizeof(header), dev->context))
-            return false;
+        ctx->header = (uint16_t)(ctx->buffer[RX_HEADER_OFFSET] |
+                                 (ctx->buffer[RX_HEADER_OFFSET + 1] << 8));
 
         // Not a data/source capabilities message, continue waiting
         if (
-          !HEADER_NUM_DATA_OBJECTS(header) ||
-          HEADER_MESSAGE_TYPE(header) != STUSB_SRC_CAPABILITIES_MSG)
-            continue;
-
-        // Read number of received bytes
-        if (!dev->read(dev->addr, STUSB_RX_BYTE_CNT, buffer, 1, dev->context)) return false;
+          !HEADER_NUM_DATA_OBJECTS(ctx->header) ||
+          HEADER_MESSAGE_TYPE(ctx->header) != STUSB_SRC_CAPABILITIES_MSG) {
+            ctx->state = NEGOTIATE_WAIT_MESSAGE;
+            break;
+        }
 
         // Check for missing data
-        if (buffer[0] != HEADER_NUM_DATA_OBJECTS(header) * sizeof(stusb4500_pdo_t)) return false;
+        if (
+          ctx->buffer[RX_BYTE_CNT_OFFSET] !=
+          HEADER_NUM_DATA_OBJECTS(ctx->header) * sizeof(stusb4500_pdo_t))
+            return STUSB4500_NEGOTIATE_ERROR;
+
+        ctx->num_src_pdos = HEADER_NUM_DATA_OBJECTS(ctx->header);
+        memcpy(
+          ctx->src_pdos,
+          &ctx->buffer[RX_DATA_OBJ_OFFSET],
+          ctx->num_src_pdos * sizeof(stusb4500_pdo_t));
+
+        // A known source gets the cached choice. Done if it was loaded ahead of the soft reset
+        predicted_pdo = ctx->snk_pdo;
+        ctx->fingerprint = fingerprint(ctx->config, ctx->src_pdos, ctx->num_src_pdos);
+        ctx->cache_hit = cache_lookup(ctx->config->cache, ctx->fingerprint, &ctx->snk_pdo);
+        // Only PDO3 is predicted, a full set still has to be checked
+        if (
+          ctx->cache_hit && ctx->predicted && ctx->snk_pdo == predicted_pdo &&
+          !ctx->config->load_all_pdos) {
+            ctx->state = NEGOTIATE_UNCHANGED;
+            break;
+        }
+
+        // Wait for idle state before checking the contract
+        wait_until_ready(ctx, NEGOTIATE_CHECK_CONTRACT);
+        break;
+
+    case NEGOTIATE_CHECK_CONTRACT:
+        // Find the optimal PDO, if any, unless the source is known
+        if (!ctx->cache_hit) {
+            if (!find_optimal_pdo(ctx)) return STUSB4500_NEGOTIATE_ERROR;
+            cache_insert(ctx->config->cache, ctx->fingerprint, ctx->snk_pdo);
+        }
+
+        if (!ctx->config->load_all_pdos) {
+            // Read back sink PDO3 and the active RDO, the registers are contiguous
+            if (!stusb4500_read(
+                  dev, STUSB_DPM_SNK_PDO3, ctx->buffer, 2 * sizeof(stusb4500_pdo_t)))
+                return STUSB4500_NEGOTIATE_ERROR;
+
+            memcpy(&snk_pdo3, &ctx->buffer[0], sizeof(snk_pdo3));
+            memcpy(&rdo, &ctx->buffer[sizeof(snk_pdo3)], sizeof(rdo));
+            loaded = true;
+        } else {
+            // The fallbacks are derived from the source capabilities, the optimal PDO is the
+            // cached or searched one
+            ctx->num_snk_pdos = stusb4500_pdo_snk_set(
+              ctx->config, ctx->src_pdos, ctx->num_src_pdos, ctx->snk_pdos);
+            if (!ctx->num_snk_pdos) return STUSB4500_NEGOTIATE_ERROR;
+            keep_optimal_pdo(ctx);
+
+            // Read back the number of PDOs, all sink PDOs and the active RDO
+            stusb4500_msg_t const msgs[] = {
+              STUSB4500_READ_MSG(STUSB_DPM_PDO_NUMB, &ctx->buffer[0], 1),
+              STUSB4500_READ_MSG(
+                STUSB_DPM_SNK_PDO1, &ctx->buffer[1], SNK_PDOS_RDO_OFFSET + sizeof(rdo)),
+            };
+            if (!stusb4500_transfer(dev, msgs, STUSB4500_NUM_MSGS(msgs)))
+                return STUSB4500_NEGOTIATE_ERROR;
+
+            snk_pdo3 = ctx->snk_pdo;
+            memcpy(&rdo, &ctx->buffer[1 + SNK_PDOS_RDO_OFFSET], sizeof(rdo));
+            loaded = is_snk_set_loaded(ctx, ctx->buffer);
+        }
+
+        // Renegotiating would not change the contract
+        ctx->state = (loaded && is_contract_active(ctx, snk_pdo3, rdo)) ? NEGOTIATE_UNCHANGED
+                                                                         : NEGOTIATE_LOAD_PDO;
+        break;
 
+    case NEGOTIATE_LOAD_PDO:
+        // Push the new PDO, or the full set of PDOs in one transaction
+        if (ctx->config->load_all_pdos) {
+            if (!stusb4500_load_pdos(dev, ctx->snk_pdos, ctx->num_snk_pdos))
+                return STUSB4500_NEGOTIATE_ERROR;
+        } else if (!write_pdo(dev, ctx->snk_pdo, 3)) {
+            return STUSB4500_NEGOTIATE_ERROR;
+        }
+
+        // Force a renegotiation
+        ctx->pdo_loaded = true;
+        ctx->state = NEGOTIATE_SEND_SOFT_RESET_HEADER;
+        break;
+
+    case NEGOTIATE_FINISHED:
+    case NEGOTIATE_UNCHANGED:
+    case NEGOTIATE_DETACHED:
         break;
+
+    default:
+        return STUSB4500_NEGOTIATE_ERROR;
     }
 
-    // Read source capabilities
-    // WARNING: This must happen very soon after the previous code block is executed. The source
-    // will send an accept message which partially overwrites the source capabilities message.
-    // Use i2c clock >= 300 kHz
-    if (!dev->read(
-          dev->addr,
-          STUSB_RX_DATA_OBJ,
-          buffer,
-          HEADER_NUM_DATA_OBJECTS(header) * sizeof(stusb4500_pdo_t),
-          dev->context))
-        return false;
+    switch (ctx->state) {
+    case NEGOTIATE_FINISHED:
+        return STUSB4500_NEGOTIATE_DONE;
+    case NEGOTIATE_UNCHANGED:
+        return STUSB4500_NEGOTIATE_SKIPPED;
+    case NEGOTIATE_DETACHED:
+        return STUSB4500_NEGOTIATE_DETACHED;
+    default:
+        return STUSB4500_NEGOTIATE_PENDING;
+    }
+}
+
+void stusb4500_negotiate_start(
+  stusb4500_negotiation_t* ctx,
+  stusb4500_t const* dev,
+  stusb4500_config_t const* config,
+  bool on_interrupt) {
+    if (!ctx) return;
+
+    ctx->dev = dev;
+    ctx->config = config;
+    ctx->on_interrupt = on_interrupt;
+    ctx->pdo_loaded = false;
+    ctx->predicted = false;
+    ctx->cache_hit = false;
+    ctx->fingerprint = 0;
+    ctx->snk_pdo = 0;
+    ctx->num_snk_pdos = 0;
+    ctx->header = 0;
+    ctx->num_src_pdos = 0;
+    ctx->num_candidates = 0;
+    ctx->capture_locked = false;
+    ctx->waiting = false;
+    stusb4500_backoff_start(&ctx->backoff, NULL, 0, 0);
+    ctx->next_state = NEGOTIATE_FAILED;
+    ctx->state = (dev && config) ? NEGOTIATE_CHECK_PRESENT : NEGOTIATE_FAILED;
+#ifdef STUSB4500_METRICS
+    ctx->metrics_start = METRICS_NOW(dev);
+    ctx->phase_start = ctx->metrics_start;
+#endif // STUSB4500_METRICS
+}
+
+#ifdef STUSB4500_METRICS
+static stusb4500_phase_t phase_of(uint8_t state) {
+    switch (state) {
+    case NEGOTIATE_CHECK_PRESENT:
+    case NEGOTIATE_CHECK_ATTACHED:
+        return STUSB4500_PHASE_ATTACH;
+    case NEGOTIATE_WAIT_READY:
+        return STUSB4500_PHASE_WAIT_READY;
+    case NEGOTIATE_SEND_SOFT_RESET_HEADER:
+    case NEGOTIATE_SEND_SOFT_RESET_CMD:
+        return STUSB4500_PHASE_SOFT_RESET;
+    case NEGOTIATE_WAIT_MESSAGE:
+    case NEGOTIATE_CAPTURE:
+        return STUSB4500_PHASE_WAIT_CAPS;
+    case NEGOTIATE_CHECK_CONTRACT:
+        return STUSB4500_PHASE_SELECT_PDO;
+    case NEGOTIATE_PREDICT_PDO:
+    case NEGOTIATE_LOAD_PDO:
+        return STUSB4500_PHASE_LOAD_PDO;
+    default:
+        return STUSB4500_NUM_PHASES;
+    }
+}
+
+// Account for a poll which moved the negotiation from prev_state to its current state
+static void track_metrics(
+  stusb4500_negotiation_t* ctx, uint8_t prev_state, stusb4500_negotiate_status_t status) {
+    stusb4500_t const* dev = ctx->dev;
+
+    if (!dev || !dev->metrics) return;
+
+    if (
+      (prev_state == NEGOTIATE_WAIT_READY || prev_state == NEGOTIATE_WAIT_MESSAGE) &&
+      ctx->state != prev_state) {
+        METRICS_WAIT(
+          dev,
+          (prev_state == NEGOTIATE_WAIT_READY) ? STUSB4500_WAIT_PE_READY : STUSB4500_WAIT_MESSAGE,
+          ctx->backoff.polls);
+    }
+
+    if (phase_of(ctx->state) != phase_of(prev_state)) {
+        METRICS_PHASE(dev, phase_of(prev_state), ctx->phase_start);
+        ctx->phase_start = METRICS_NOW(dev);
+    }
+
+    if (status != STUSB4500_NEGOTIATE_PENDING)
+        METRICS_PHASE(dev, STUSB4500_PHASE_NEGOTIATE, ctx->metrics_start);
+}
+#endif // STUSB4500_METRICS
+
+stusb4500_negotiate_status_t stusb4500_negotiate_poll(stusb4500_negotiation_t* ctx) {
+    if (!ctx) return STUSB4500_NEGOTIATE_ERROR;
+
+#ifdef STUSB4500_METRICS
+    uint8_t const prev_state = ctx->state;
+#endif // STUSB4500_METRICS
 
-    // Wait for idle state before loading new PDO
-    if (!wait_until_ready_with_timeout(dev, config)) return false;
+    stusb4500_negotiate_status_t status = step(ctx);
+    if (status == STUSB4500_NEGOTIATE_ERROR) ctx->state = NEGOTIATE_FAILED;
 
-    // Find and load the optimal PDO, if any
-    if (!load_optimal_pdo(dev, config, (stusb4500_pdo_t*)buffer, HEADER_NUM_DATA_OBJECTS(header)))
+    // Release the bus unless the source capabilities are about to be captured
+    if (ctx->capture_locked && ctx->state != NEGOTIATE_CAPTURE) {
+        stusb4500_unlock(ctx->dev);
+        ctx->capture_locked = false;
+    }
+
+#ifdef STUSB4500_METRICS
+    track_metrics(ctx, prev_state, status);
+#endif // STUSB4500_METRICS
+
+    return status;
+}
+
+bool stusb4500_negotiate_is_waiting(stusb4500_negotiation_t const* ctx) {
+    return ctx && ctx->waiting;
+}
+
+uint32_t stusb4500_negotiate_delay_us(stusb4500_negotiation_t const* ctx) {
+    return (ctx && ctx->waiting) ? ctx->backoff.delay_us : 0;
+}
+
+bool stusb4500_negotiate_is_capturing(stusb4500_negotiation_t const* ctx) {
+    if (!ctx) return false;
+
+    switch (ctx->state) {
+    case NEGOTIATE_SEND_SOFT_RESET_HEADER:
+    case NEGOTIATE_SEND_SOFT_RESET_CMD:
+        return !ctx->pdo_loaded;
+    case NEGOTIATE_WAIT_MESSAGE:
+    case NEGOTIATE_CAPTURE:
+        return true;
+    default:
         return false;
+    }
+}
+
+void stusb4500_negotiate_cancel(stusb4500_negotiation_t* ctx) {
+    if (!ctx) return;
+
+    // The bus may be held for a capture which will not happen anymore
+    if (ctx->capture_locked) {
+        stusb4500_unlock(ctx->dev);
+        ctx->capture_locked = false;
+    }
+
+    ctx->waiting = false;
+    ctx->state = NEGOTIATE_DETACHED;
+}
+
+stusb4500_candidate_t const*
+  stusb4500_negotiate_candidates(stusb4500_negotiation_t const* ctx, uint8_t* num_candidates) {
+    if (!ctx) return NULL;
+
+    if (num_candidates) *num_candidates = ctx->num_candidates;
+    return ctx->candidates;
+}
+
+bool stusb4500_negotiate(
+  stusb4500_t const* dev, stusb4500_config_t const* config, bool on_interrupt) {
+    stusb4500_negotiation_t ctx;
+    stusb4500_negotiate_status_t status;
+
+    stusb4500_negotiate_start(&ctx, dev, config, on_interrupt);
+
+    do {
+        status = stusb4500_negotiate_poll(&ctx);
+
+        if (status != STUSB4500_NEGOTIATE_PENDING || !ctx.waiting) continue;
+
+        // Sleep until the STUSB4500 has something new to report instead of polling it, or space
+        // out the polls
+        if (dev->wait_alert) {
+            stusb4500_backoff_wait_alert(dev, &ctx.backoff);
+        } else {
+            stusb4500_backoff_sleep(dev, &ctx.backoff);
+        }
+    } while (status == STUSB4500_NEGOTIATE_PENDING);
+
+    return (status == STUSB4500_NEGOTIATE_DONE || status == STUSB4500_NEGOTIATE_SKIPPED);
+}
+
+bool stusb4500_alert_enable(stusb4500_t const* dev, stusb4500_alert_t alerts) {
+    uint8_t const mask = (uint8_t)(STUSB_ALERT_MASK_ALL & ~alerts);
+    uint8_t buffer[ALERT_BLOCK_SIZE];
+
+    // Unmask the requested alerts, then clear anything pending so ALERT is released
+    stusb4500_msg_t const msgs[] = {
+      STUSB4500_WRITE_MSG(STUSB_ALERT_STATUS_1_MASK, &mask, 1),
+      STUSB4500_READ_MSG(STUSB_ALERT_STATUS_1, buffer, ALERT_BLOCK_SIZE),
+    };
+    return stusb4500_transfer(dev, msgs, STUSB4500_NUM_MSGS(msgs));
+}
+
+bool stusb4500_alert_read(stusb4500_t const* dev, stusb4500_alert_t* alerts) {
+    if (!alerts) return false;
+
+    return stusb4500_read(dev, STUSB_ALERT_STATUS_1, alerts, 1);
+}
+
+bool stusb4500_load_pdos(stusb4500_t const* dev, uint32_t const* snk_pdos, uint8_t num_pdos) {
+    stusb4500_pdo_t pdos[STUSB4500_NUM_SNK_PDOS] = {0};
+
+    if (!snk_pdos || num_pdos < 1 || num_pdos > STUSB4500_NUM_SNK_PDOS) return false;
+
+    // Unused PDOs are cleared so all three are written in a single burst
+    memcpy(pdos, snk_pdos, num_pdos * sizeof(stusb4500_pdo_t));
 
-    // Force a renegotiation
-    return send_pd_message(dev, PD_SOFT_RESET);
+    stusb4500_msg_t const msgs[] = {
+      STUSB4500_WRITE_MSG(STUSB_DPM_SNK_PDO1, pdos, SNK_PDOS_SIZE),
+      STUSB4500_WRITE_MSG(STUSB_DPM_PDO_NUMB, &num_pdos, 1),
+    };
+    return stusb4500_transfer(dev, msgs, STUSB4500_NUM_MSGS(msgs));
 }
 
 bool stusb4500_set_gpio_state(stusb4500_t const* dev, stusb4500_gpio_state_t state) {
@@ -276,5 +866,5 @@ bool stusb4500_set_gpio_state(stusb4500_t const* dev, stusb4500_gpio_state_t sta
     if (!is_present(dev)) return false;
 
     // Set GPIO state
-    return dev->write(dev->addr, STUSB_GPIO3_SW_GPIO, &state, sizeof(state), dev->context);
+    return stusb4500_write(dev, STUSB_GPIO3_SW_GPIO, &state, sizeof(state));
 }
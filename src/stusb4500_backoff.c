@@ -0,0 +1,57 @@
+#include "stusb4500_backoff.h"
+
+static uint32_t elapsed_ms(stusb4500_backoff_t const* backoff) {
+    if (backoff->get_ms) return backoff->get_ms() - backoff->start_ms;
+
+    return backoff->elapsed_us / 1000UL;
+}
+
+void stusb4500_backoff_start(
+  stusb4500_backoff_t* backoff,
+  stusb4500_get_ms_func_t get_ms,
+  uint32_t timeout_ms,
+  uint32_t max_delay_us) {
+    backoff->get_ms = get_ms;
+    backoff->start_ms = get_ms ? get_ms() : 0;
+    backoff->timeout_ms = timeout_ms ? timeout_ms : STUSB4500_TIMEOUT_MS;
+    backoff->elapsed_us = 0;
+    backoff->polls = 0;
+    backoff->delay_us = 0;
+    backoff->max_delay_us = max_delay_us;
+}
+
+bool stusb4500_backoff_poll(stusb4500_backoff_t* backoff) {
+    if (elapsed_ms(backoff) > backoff->timeout_ms) return false;
+
+    backoff->polls++;
+    backoff->elapsed_us += STUSB4500_BACKOFF_POLL_US;
+
+    // Double the delay once past the fast polls
+    if (backoff->polls >= STUSB4500_BACKOFF_FAST_POLLS) {
+        backoff->delay_us =
+          backoff->delay_us ? 2 * backoff->delay_us : STUSB4500_BACKOFF_MIN_DELAY_US;
+        if (backoff->delay_us > backoff->max_delay_us) backoff->delay_us = backoff->max_delay_us;
+    }
+
+    return true;
+}
+
+void stusb4500_backoff_sleep(stusb4500_t const* dev, stusb4500_backoff_t* backoff) {
+    if (!dev->delay || !backoff->delay_us) return;
+
+    dev->delay(backoff->delay_us, dev->context);
+    backoff->elapsed_us += backoff->delay_us;
+}
+
+uint32_t stusb4500_backoff_remaining_ms(stusb4500_backoff_t const* backoff) {
+    uint32_t const elapsed = elapsed_ms(backoff);
+
+    return (elapsed < backoff->timeout_ms) ? backoff->timeout_ms - elapsed : 0;
+}
+
+void stusb4500_backoff_wait_alert(stusb4500_t const* dev, stusb4500_backoff_t* backoff) {
+    uint32_t const timeout_ms = stusb4500_backoff_remaining_ms(backoff);
+
+    // How long an asserted ALERT took is unknown, only the poll that follows is accounted for
+    if (!dev->wait_alert(timeout_ms, dev->context)) backoff->elapsed_us += timeout_ms * 1000UL;
+}
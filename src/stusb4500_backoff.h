@@ -0,0 +1,24 @@
+#pragma once
+
+#include "stusb4500.h"
+#include "stusb4500_defs.h"
+
+// Bounded wait shared by all status polling loops. The first polls are made back to back, then the
+// delay between polls doubles up to a per-wait limit. Without a clock, the deadline is checked
+// against the sleep time plus an estimate of the time spent polling. See STUSB4500_BACKOFF_* of
+// stusb4500_defs.h
+
+// Start a wait of timeout_ms, STUSB4500_TIMEOUT_MS if 0. get_ms is optional
+void stusb4500_backoff_start(
+  stusb4500_backoff_t* backoff,
+  stusb4500_get_ms_func_t get_ms,
+  uint32_t timeout_ms,
+  uint32_t max_delay_us);
+// Account for a status poll about to be made. Returns false once the deadline has passed
+bool stusb4500_backoff_poll(stusb4500_backoff_t* backoff);
+// Sleep through dev->delay before the next poll, if set and the wait has backed off
+void stusb4500_backoff_sleep(stusb4500_t const* dev, stusb4500_backoff_t* backoff);
+uint32_t stusb4500_backoff_remaining_ms(stusb4500_backoff_t const* backoff);
+// Block in dev->wait_alert until ALERT is asserted or the remaining time has passed. Without a
+// clock, a wait which times out counts in full toward the deadline
+void stusb4500_backoff_wait_alert(stusb4500_t const* dev, stusb4500_backoff_t* backoff);
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "stusb4500.h"
+#include "stusb4500_metrics.h"
+
+#define STUSB4500_WRITE_MSG(reg, buf, len)                                                         \
+    { (reg), STUSB4500_MSG_WRITE, (void*)(buf), (len) }
+#define STUSB4500_READ_MSG(reg, buf, len)                                                          \
+    { (reg), STUSB4500_MSG_READ, (buf), (len) }
+#define STUSB4500_NUM_MSGS(msgs) (sizeof(msgs) / sizeof((msgs)[0]))
+
+// Start a sequence of bus transactions which must not be interleaved with other accesses to the
+// bus. Sequences nest
+static inline void stusb4500_lock(stusb4500_t const* dev) {
+    if (dev->lock) dev->lock(dev->lock_context);
+}
+
+static inline void stusb4500_unlock(stusb4500_t const* dev) {
+    if (dev->unlock) dev->unlock(dev->lock_context);
+}
+
+static inline bool stusb4500_read(stusb4500_t const* dev, uint8_t reg, void* buf, size_t len) {
+    stusb4500_lock(dev);
+    bool const ok = dev->read(dev->addr, reg, buf, len, dev->context);
+    METRICS_ACCESS(dev, STUSB4500_MSG_READ, len);
+    METRICS_TRANSACTION(dev, ok);
+    stusb4500_unlock(dev);
+
+    return ok;
+}
+
+static inline bool
+  stusb4500_write(stusb4500_t const* dev, uint8_t reg, void const* buf, size_t len) {
+    stusb4500_lock(dev);
+    bool const ok = dev->write(dev->addr, reg, buf, len, dev->context);
+    METRICS_ACCESS(dev, STUSB4500_MSG_WRITE, len);
+    METRICS_TRANSACTION(dev, ok);
+    stusb4500_unlock(dev);
+
+    return ok;
+}
+
+// Perform a batch of register accesses, in one bus transaction if the device supports it
+static inline bool
+  stusb4500_transfer(stusb4500_t const* dev, stusb4500_msg_t const* msgs, size_t num_msgs) {
+    bool ok = true;
+
+    if (dev->transfer) {
+        stusb4500_lock(dev);
+        ok = dev->transfer(dev->addr, msgs, num_msgs, dev->context);
+        for (size_t i = 0; i < num_msgs; i++) {
+            METRICS_ACCESS(dev, msgs[i].dir, msgs[i].len);
+        }
+        METRICS_TRANSACTION(dev, ok);
+        stusb4500_unlock(dev);
+
+        return ok;
+    }
+
+    // Individual accesses, kept together on the bus
+    stusb4500_lock(dev);
+    for (size_t i = 0; i < num_msgs && ok; i++) {
+        stusb4500_msg_t const* msg = &msgs[i];
+        ok = (msg->dir == STUSB4500_MSG_READ)
+               ? stusb4500_read(dev, msg->reg, msg->buf, msg->len)
+               : stusb4500_write(dev, msg->reg, msg->buf, msg->len);
+    }
+    stusb4500_unlock(dev);
+
+    return ok;
+}
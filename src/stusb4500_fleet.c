@@ -0,0 +1,220 @@
+#include "stusb4500_fleet.h"
+
+#ifdef STUSB4500_FLEET_THREADS
+#include <pthread.h>
+#endif // STUSB4500_FLEET_THREADS
+
+// Buses served by one worker
+typedef struct {
+    stusb4500_fleet_bus_t* buses;
+    size_t num_buses;
+    stusb4500_config_t const* config;
+    bool on_interrupt;
+    bool ok;
+} worker_t;
+
+typedef void (*worker_func_t)(worker_t* worker);
+
+static uint32_t elapsed_ms(stusb4500_config_t const* config, uint32_t start) {
+    return config->get_ms ? config->get_ms() - start : 0;
+}
+
+// Poll a device once, or until it waits for its STUSB4500. Returns true when it is finished
+static bool serve(
+  worker_t* worker, stusb4500_fleet_device_t* device, uint32_t start, bool until_waiting) {
+    do {
+        device->status = stusb4500_negotiate_poll(&device->negotiation);
+    } while (
+      until_waiting && device->status == STUSB4500_NEGOTIATE_PENDING &&
+      !stusb4500_negotiate_is_waiting(&device->negotiation));
+
+    if (device->status == STUSB4500_NEGOTIATE_PENDING) return false;
+
+    // Sources attached at once send their capabilities at once, and not all of them can be read
+    // in time. A device which missed them asks again with a soft reset
+    if (device->status == STUSB4500_NEGOTIATE_ERROR && device->on_interrupt) {
+        device->on_interrupt = false;
+        stusb4500_negotiate_start(&device->negotiation, device->dev, worker->config, false);
+        device->status = STUSB4500_NEGOTIATE_PENDING;
+        return false;
+    }
+
+    device->elapsed_ms = elapsed_ms(worker->config, start);
+    if (device->status != STUSB4500_NEGOTIATE_DONE && device->status != STUSB4500_NEGOTIATE_SKIPPED)
+        worker->ok = false;
+    return true;
+}
+
+// Sleep through the delay hook of a pending device for the shortest backoff of the pending
+// devices, if all of them are waiting for their STUSB4500. Devices held back for the capture of
+// another one do not count
+static void idle(worker_t const* worker, stusb4500_fleet_device_t const* capturing) {
+    stusb4500_t const* sleeper = NULL;
+    uint32_t delay_us = UINT32_MAX;
+
+    for (size_t i = 0; i < worker->num_buses; i++) {
+        stusb4500_fleet_bus_t const* bus = &worker->buses[i];
+
+        for (size_t j = 0; j < bus->num_devices; j++) {
+            stusb4500_fleet_device_t const* device = &bus->devices[j];
+            uint32_t const device_delay_us = stusb4500_negotiate_delay_us(&device->negotiation);
+            bool const held = capturing && device != capturing && !device->on_interrupt &&
+                              stusb4500_negotiate_is_capturing(&device->negotiation);
+
+            if (device->status != STUSB4500_NEGOTIATE_PENDING || held) continue;
+            if (device_delay_us < delay_us) delay_us = device_delay_us;
+            if (!sleeper && device->dev->delay) sleeper = device->dev;
+        }
+    }
+
+    if (sleeper && delay_us && delay_us != UINT32_MAX) sleeper->delay(delay_us, sleeper->context);
+}
+
+static void negotiate_worker(worker_t* worker) {
+    stusb4500_config_t const* config = worker->config;
+    uint32_t const start = config->get_ms ? config->get_ms() : 0;
+    stusb4500_fleet_device_t* capturing = NULL;
+    size_t pending = 0;
+
+    for (size_t i = 0; i < worker->num_buses; i++) {
+        stusb4500_fleet_bus_t* bus = &worker->buses[i];
+
+        for (size_t j = 0; j < bus->num_devices; j++) {
+            stusb4500_fleet_device_t* device = &bus->devices[j];
+
+            stusb4500_negotiate_start(
+              &device->negotiation, device->dev, config, worker->on_interrupt);
+            device->on_interrupt = worker->on_interrupt;
+            device->status = STUSB4500_NEGOTIATE_PENDING;
+            device->elapsed_ms = 0;
+            pending++;
+        }
+    }
+
+    // The source capabilities must be read within a few ms of their arrival, which polling many
+    // devices in turn cannot guarantee. Unless the sources send them on their own, only one device
+    // at a time solicits them, and it is polled in between every transaction to the others. A
+    // device which has found a message sent on its own is served until it is read. A pass which
+    // leaves all devices busy is followed by a sleep
+    while (pending) {
+        for (size_t i = 0; i < worker->num_buses; i++) {
+            stusb4500_fleet_bus_t* bus = &worker->buses[i];
+
+            for (size_t j = 0; j < bus->num_devices; j++) {
+                stusb4500_fleet_device_t* device = &bus->devices[j];
+
+                if (device != capturing && device->status == STUSB4500_NEGOTIATE_PENDING) {
+                    bool const held = capturing && !device->on_interrupt &&
+                                      stusb4500_negotiate_is_capturing(&device->negotiation);
+
+                    if (!held && serve(worker, device, start, false)) {
+                        pending--;
+                    } else if (held || !stusb4500_negotiate_is_capturing(&device->negotiation)) {
+                        // Nothing to capture
+                    } else if (!device->on_interrupt) {
+                        if (!capturing) capturing = device;
+                    } else if (
+                      !stusb4500_negotiate_is_waiting(&device->negotiation) &&
+                      serve(worker, device, start, true)) {
+                        // A message has been found, it is read before any other device is served
+                        pending--;
+                    }
+                }
+
+                if (!capturing) continue;
+
+                if (serve(worker, capturing, start, true)) {
+                    pending--;
+                    capturing = NULL;
+                } else if (!stusb4500_negotiate_is_capturing(&capturing->negotiation)) {
+                    capturing = NULL;
+                }
+            }
+        }
+
+        if (pending) idle(worker, capturing);
+    }
+}
+
+static void nvm_read_worker(worker_t* worker) {
+    for (size_t i = 0; i < worker->num_buses; i++) {
+        stusb4500_fleet_bus_t* bus = &worker->buses[i];
+
+        for (size_t j = 0; j < bus->num_devices; j++) {
+            stusb4500_fleet_device_t* device = &bus->devices[j];
+
+            device->nvm_ok = stusb4500_nvm_read(device->dev, device->nvm);
+            if (!device->nvm_ok) worker->ok = false;
+        }
+    }
+}
+
+#ifdef STUSB4500_FLEET_THREADS
+typedef struct {
+    worker_t worker;
+    worker_func_t func;
+} thread_arg_t;
+
+static void* worker_thread(void* arg) {
+    thread_arg_t* thread_arg = (thread_arg_t*)arg;
+
+    thread_arg->func(&thread_arg->worker);
+    return NULL;
+}
+#endif // STUSB4500_FLEET_THREADS
+
+static bool run_workers(worker_t const* all, worker_func_t func) {
+    if (!all->buses || !all->num_buses) return false;
+
+#ifdef STUSB4500_FLEET_THREADS
+    // One worker per bus
+    thread_arg_t args[STUSB4500_FLEET_MAX_BUSES];
+    pthread_t threads[STUSB4500_FLEET_MAX_BUSES];
+    bool started[STUSB4500_FLEET_MAX_BUSES];
+    bool ok = true;
+
+    if (all->num_buses > STUSB4500_FLEET_MAX_BUSES) return false;
+
+    for (size_t i = 0; i < all->num_buses; i++) {
+        args[i].worker = *all;
+        args[i].worker.buses = &all->buses[i];
+        args[i].worker.num_buses = 1;
+        args[i].worker.ok = true;
+        args[i].func = func;
+        started[i] = (pthread_create(&threads[i], NULL, worker_thread, &args[i]) == 0);
+
+        // Out of threads, serve the bus from here
+        if (!started[i]) func(&args[i].worker);
+    }
+
+    for (size_t i = 0; i < all->num_buses; i++) {
+        if (started[i]) pthread_join(threads[i], NULL);
+        ok = ok && args[i].worker.ok;
+    }
+
+    return ok;
+#else  // STUSB4500_FLEET_THREADS
+    worker_t worker = *all;
+
+    worker.ok = true;
+    func(&worker);
+
+    return worker.ok;
+#endif // STUSB4500_FLEET_THREADS
+}
+
+bool stusb4500_fleet_negotiate(
+  stusb4500_fleet_bus_t* buses,
+  size_t num_buses,
+  stusb4500_config_t const* config,
+  bool on_interrupt) {
+    if (!config) return false;
+
+    worker_t const all = {buses, num_buses, config, on_interrupt, true};
+    return run_workers(&all, negotiate_worker);
+}
+
+bool stusb4500_fleet_nvm_read(stusb4500_fleet_bus_t* buses, size_t num_buses) {
+    worker_t const all = {buses, num_buses, NULL, false, true};
+    return run_workers(&all, nvm_read_worker);
+}
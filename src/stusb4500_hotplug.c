@@ -0,0 +1,104 @@
+#include "stusb4500_hotplug.h"
+
+#include "stusb4500_bus.h"
+#include "stusb4500_regs.h"
+
+#include <string.h>
+
+static uint32_t now_ms(stusb4500_hotplug_t const* hotplug) {
+    return hotplug->config->get_ms ? hotplug->config->get_ms() : 0;
+}
+
+// True once the attach has been stable for the debounce time
+static bool is_settled(stusb4500_hotplug_t const* hotplug) {
+    uint32_t const debounce_ms =
+      hotplug->debounce_ms ? hotplug->debounce_ms : STUSB4500_HOTPLUG_DEBOUNCE_MS;
+
+    // Without a clock, being seen by two polls in a row has to do
+    if (!hotplug->config->get_ms) return true;
+
+    return now_ms(hotplug) - hotplug->settle_start_ms >= debounce_ms;
+}
+
+void stusb4500_hotplug_init(
+  stusb4500_hotplug_t* hotplug, stusb4500_t const* dev, stusb4500_config_t const* config) {
+    if (!hotplug) return;
+
+    memset(hotplug, 0, sizeof(*hotplug));
+    hotplug->dev = dev;
+    hotplug->config = config;
+}
+
+stusb4500_hotplug_event_t stusb4500_hotplug_detached(stusb4500_hotplug_t* hotplug) {
+    if (!hotplug) return STUSB4500_HOTPLUG_NONE;
+
+    if (hotplug->negotiating) {
+        stusb4500_negotiate_cancel(&hotplug->negotiation);
+        hotplug->negotiating = false;
+    }
+
+    hotplug->settling = false;
+    if (!hotplug->attached) return STUSB4500_HOTPLUG_NONE;
+
+    hotplug->attached = false;
+    return STUSB4500_HOTPLUG_DETACHED;
+}
+
+static stusb4500_hotplug_event_t negotiate(stusb4500_hotplug_t* hotplug) {
+    switch (stusb4500_negotiate_poll(&hotplug->negotiation)) {
+    case STUSB4500_NEGOTIATE_PENDING:
+        return STUSB4500_HOTPLUG_NONE;
+    case STUSB4500_NEGOTIATE_DONE:
+    case STUSB4500_NEGOTIATE_SKIPPED:
+        hotplug->negotiating = false;
+        return STUSB4500_HOTPLUG_NEGOTIATED;
+    case STUSB4500_NEGOTIATE_DETACHED:
+        hotplug->negotiating = false;
+        return stusb4500_hotplug_detached(hotplug);
+    default:
+        hotplug->negotiating = false;
+        return STUSB4500_HOTPLUG_FAILED;
+    }
+}
+
+stusb4500_hotplug_event_t stusb4500_hotplug_poll(stusb4500_hotplug_t* hotplug) {
+    uint8_t port_status;
+
+    if (!hotplug || !hotplug->dev || !hotplug->config) return STUSB4500_HOTPLUG_NONE;
+
+    // The negotiation watches the attach state itself
+    if (hotplug->negotiating) return negotiate(hotplug);
+
+    if (!stusb4500_read(hotplug->dev, STUSB4500_REG_PORT_STATUS_1, &port_status, 1))
+        return STUSB4500_HOTPLUG_NONE;
+
+    if (!(port_status & STUSB4500_PORT_STATUS_1_ATTACH)) return stusb4500_hotplug_detached(hotplug);
+
+    // Attached and negotiated, or failed until the next attach
+    if (hotplug->attached) return STUSB4500_HOTPLUG_NONE;
+
+    // Contacts may bounce while the plug goes in
+    if (!hotplug->settling) {
+        hotplug->settling = true;
+        hotplug->settle_start_ms = now_ms(hotplug);
+        return STUSB4500_HOTPLUG_NONE;
+    }
+    if (!is_settled(hotplug)) return STUSB4500_HOTPLUG_NONE;
+
+    // The source capabilities sent at attach are long gone, solicit them again
+    hotplug->settling = false;
+    hotplug->attached = true;
+    hotplug->negotiating = true;
+    stusb4500_negotiate_start(&hotplug->negotiation, hotplug->dev, hotplug->config, false);
+    return STUSB4500_HOTPLUG_ATTACHED;
+}
+
+bool stusb4500_hotplug_is_negotiating(stusb4500_hotplug_t const* hotplug) {
+    return hotplug && hotplug->negotiating;
+}
+
+uint32_t stusb4500_hotplug_delay_us(stusb4500_hotplug_t const* hotplug) {
+    if (!stusb4500_hotplug_is_negotiating(hotplug)) return 0;
+
+    return stusb4500_negotiate_delay_us(&hotplug->negotiation);
+}
@@ -0,0 +1,126 @@
+#include "stusb4500_linux.h"
+
+#include <fcntl.h>
+#include <linux/i2c-dev.h>
+#include <linux/i2c.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+// Register address ahead of every access
+#define REG_SIZE 1UL
+
+// Messages of one ioctl. Each register access is a register address write, followed by the data
+// read for reads, or by the data in the same message for writes
+typedef struct {
+    struct i2c_msg msgs[STUSB4500_LINUX_MAX_MSGS];
+    size_t num_msgs;
+    uint8_t data[STUSB4500_LINUX_BUFFER_SIZE];
+    size_t data_len;
+} batch_t;
+
+static int system_ioctl(int fd, unsigned long request, void* arg) {
+    return ioctl(fd, request, arg);
+}
+
+static bool submit(stusb4500_linux_bus_t* bus, batch_t* batch) {
+    struct i2c_rdwr_ioctl_data rdwr;
+    stusb4500_linux_ioctl_t const hook = bus->ioctl ? bus->ioctl : system_ioctl;
+
+    if (!batch->num_msgs) return true;
+
+    rdwr.msgs = batch->msgs;
+    rdwr.nmsgs = (uint32_t)batch->num_msgs;
+    bus->ioctls++;
+    return hook(bus->fd, I2C_RDWR, &rdwr) >= 0;
+}
+
+static void add_msg(batch_t* batch, uint16_t addr, uint16_t flags, uint8_t* buf, size_t len) {
+    struct i2c_msg* msg = &batch->msgs[batch->num_msgs++];
+
+    msg->addr = addr;
+    msg->flags = flags;
+    msg->len = (uint16_t)len;
+    msg->buf = buf;
+}
+
+// Queue a register access. Fails if it does not fit: the accesses of a transfer must not be split
+// across ioctls, the device state may change in between
+static bool add_access(batch_t* batch, uint16_t addr, stusb4500_msg_t const* access) {
+    bool const read = (access->dir == STUSB4500_MSG_READ);
+    size_t const num_msgs = read ? 2 : 1;
+    size_t const data_len = REG_SIZE + (read ? 0 : access->len);
+    uint8_t* data;
+
+    if (access->len > UINT16_MAX) return false;
+    if (
+      batch->num_msgs + num_msgs > STUSB4500_LINUX_MAX_MSGS ||
+      batch->data_len + data_len > STUSB4500_LINUX_BUFFER_SIZE)
+        return false;
+
+    data = &batch->data[batch->data_len];
+    batch->data_len += data_len;
+    data[0] = access->reg;
+
+    if (read) {
+        add_msg(batch, addr, 0, data, REG_SIZE);
+        add_msg(batch, addr, I2C_M_RD, (uint8_t*)access->buf, access->len);
+    } else {
+        if (access->len) memcpy(&data[REG_SIZE], access->buf, access->len);
+        add_msg(batch, addr, 0, data, data_len);
+    }
+
+    return true;
+}
+
+bool stusb4500_linux_open(stusb4500_linux_bus_t* bus, char const* path) {
+    if (!bus || !path) return false;
+
+    bus->fd = open(path, O_RDWR);
+    bus->ioctl = NULL;
+    bus->ioctls = 0;
+    return bus->fd >= 0;
+}
+
+void stusb4500_linux_close(stusb4500_linux_bus_t* bus) {
+    if (!bus || bus->fd < 0) return;
+
+    close(bus->fd);
+    bus->fd = -1;
+}
+
+void stusb4500_linux_bind(stusb4500_linux_bus_t* bus, stusb4500_t* dev, uint16_t addr) {
+    memset(dev, 0, sizeof(*dev));
+    dev->addr = addr;
+    dev->write = stusb4500_linux_write;
+    dev->read = stusb4500_linux_read;
+    dev->context = bus;
+    dev->transfer = stusb4500_linux_transfer;
+}
+
+bool stusb4500_linux_read(uint16_t addr, uint8_t reg, void* buf, size_t len, void* context) {
+    stusb4500_msg_t const msg = {reg, STUSB4500_MSG_READ, buf, len};
+
+    return stusb4500_linux_transfer(addr, &msg, 1, context);
+}
+
+bool stusb4500_linux_write(uint16_t addr, uint8_t reg, void const* buf, size_t len, void* context) {
+    stusb4500_msg_t const msg = {reg, STUSB4500_MSG_WRITE, (void*)buf, len};
+
+    return stusb4500_linux_transfer(addr, &msg, 1, context);
+}
+
+bool stusb4500_linux_transfer(
+  uint16_t addr, stusb4500_msg_t const* msgs, size_t num_msgs, void* context) {
+    stusb4500_linux_bus_t* bus = (stusb4500_linux_bus_t*)context;
+    batch_t batch;
+
+    batch.num_msgs = 0;
+    batch.data_len = 0;
+
+    for (size_t i = 0; i < num_msgs; i++) {
+        if (!add_access(&batch, addr, &msgs[i])) return false;
+    }
+
+    return submit(bus, &batch);
+}
@@ -0,0 +1,65 @@
+#include "stusb4500_metrics.h"
+
+#include <string.h>
+
+#ifdef STUSB4500_METRICS
+
+static void record(stusb4500_stat_t* stat, uint32_t value) {
+    uint8_t bucket = 0;
+
+    while (bucket < STUSB4500_METRICS_BUCKETS - 1 && (value >> bucket)) {
+        bucket++;
+    }
+
+    if (!stat->count || value < stat->min) stat->min = value;
+    if (!stat->count || value > stat->max) stat->max = value;
+    stat->count++;
+    stat->last = value;
+    stat->total += value;
+    stat->histogram[bucket]++;
+}
+
+uint32_t stusb4500_metrics_now(stusb4500_t const* dev) {
+    return (dev && dev->metrics && dev->metrics->get_ms) ? dev->metrics->get_ms() : 0;
+}
+
+void stusb4500_metrics_transaction(stusb4500_t const* dev, bool ok) {
+    if (!dev->metrics) return;
+
+    dev->metrics->transactions++;
+    if (!ok) dev->metrics->failed_transactions++;
+}
+
+void stusb4500_metrics_access(stusb4500_t const* dev, stusb4500_msg_dir_t dir, size_t len) {
+    if (!dev->metrics) return;
+
+    if (dir == STUSB4500_MSG_READ) {
+        dev->metrics->reads++;
+        dev->metrics->bytes_read += len;
+    } else {
+        dev->metrics->writes++;
+        dev->metrics->bytes_written += len;
+    }
+}
+
+void stusb4500_metrics_phase(stusb4500_t const* dev, stusb4500_phase_t phase, uint32_t start) {
+    if (!dev || !dev->metrics || !dev->metrics->get_ms || phase >= STUSB4500_NUM_PHASES) return;
+
+    record(&dev->metrics->phases[phase], dev->metrics->get_ms() - start);
+}
+
+void stusb4500_metrics_wait(stusb4500_t const* dev, stusb4500_wait_t wait, uint32_t polls) {
+    if (!dev || !dev->metrics || wait >= STUSB4500_NUM_WAITS) return;
+
+    record(&dev->metrics->waits[wait], polls);
+}
+
+void stusb4500_metrics_reset(stusb4500_metrics_t* metrics) {
+    if (!metrics) return;
+
+    stusb4500_get_ms_func_t const get_ms = metrics->get_ms;
+    memset(metrics, 0, sizeof(*metrics));
+    metrics->get_ms = get_ms;
+}
+
+#endif // STUSB4500_METRICS
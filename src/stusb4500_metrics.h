@@ -0,0 +1,24 @@
+#pragma once
+
+#include "stusb4500.h"
+
+// Metrics hooks, these expand to nothing unless STUSB4500_METRICS is defined
+#ifdef STUSB4500_METRICS
+uint32_t stusb4500_metrics_now(stusb4500_t const* dev);
+void stusb4500_metrics_transaction(stusb4500_t const* dev, bool ok);
+void stusb4500_metrics_access(stusb4500_t const* dev, stusb4500_msg_dir_t dir, size_t len);
+void stusb4500_metrics_phase(stusb4500_t const* dev, stusb4500_phase_t phase, uint32_t start);
+void stusb4500_metrics_wait(stusb4500_t const* dev, stusb4500_wait_t wait, uint32_t polls);
+
+#define METRICS_NOW(dev) stusb4500_metrics_now(dev)
+#define METRICS_TRANSACTION(dev, ok) stusb4500_metrics_transaction((dev), (ok))
+#define METRICS_ACCESS(dev, dir, len) stusb4500_metrics_access((dev), (dir), (len))
+#define METRICS_PHASE(dev, phase, start) stusb4500_metrics_phase((dev), (phase), (start))
+#define METRICS_WAIT(dev, wait, polls) stusb4500_metrics_wait((dev), (wait), (polls))
+#else // STUSB4500_METRICS
+#define METRICS_NOW(dev) 0UL
+#define METRICS_TRANSACTION(dev, ok) ((void)0)
+#define METRICS_ACCESS(dev, dir, len) ((void)0)
+#define METRICS_PHASE(dev, phase, start) ((void)(start))
+#define METRICS_WAIT(dev, wait, polls) ((void)(polls))
+#endif // STUSB4500_METRICS
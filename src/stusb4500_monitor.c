@@ -0,0 +1,179 @@
+#include "stusb4500_monitor.h"
+
+#include "stusb4500_bus.h"
+#include "stusb4500_pdo.h"
+#include "stusb4500_regs.h"
+
+#include <string.h>
+
+#ifdef __GNUC__
+#define LOAD_RELAXED(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define STORE_RELAXED(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define FENCE_ACQUIRE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define FENCE_RELEASE() __atomic_thread_fence(__ATOMIC_RELEASE)
+#else // __GNUC__
+// Single core targets, volatile accesses keep the sequence and snapshot accesses in order
+#define LOAD_RELAXED(p) (*(uint32_t volatile const*)(p))
+#define STORE_RELAXED(p, v) (*(uint32_t volatile*)(p) = (v))
+#define LOAD_ACQUIRE(p) LOAD_RELAXED(p)
+#define STORE_RELEASE(p, v) STORE_RELAXED(p, v)
+#define FENCE_ACQUIRE()
+#define FENCE_RELEASE()
+#endif // __GNUC__
+
+// Only registers without side effects are polled. The transition registers (PORT_STATUS_0,
+// ALERT_STATUS_1, ...) are cleared on read and belong to the ALERT handling of the application.
+// DPM_SNK_PDO1..3 and RDO_STATUS are read in one block, contiguous from DPM_SNK_PDO1
+#define RDO_OFFSET (STUSB4500_REG_RDO_STATUS - STUSB4500_REG_DPM_SNK_PDO1)
+#define STATUS_BLOCK_SIZE (RDO_OFFSET + sizeof(uint32_t))
+
+static uint32_t get_le32(uint8_t const* buf) {
+    return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) |
+           ((uint32_t)buf[3] << 24);
+}
+
+static void decode(
+  stusb4500_monitor_t const* monitor,
+  uint8_t port_status,
+  uint8_t pe_state,
+  uint8_t pdo_numb,
+  uint8_t const* block,
+  stusb4500_port_snapshot_t* snapshot) {
+    memset(snapshot, 0, sizeof(*snapshot));
+
+    snapshot->timestamp_ms = monitor->get_ms ? monitor->get_ms() : 0;
+    snapshot->attached = (port_status & STUSB4500_PORT_STATUS_1_ATTACH) != 0;
+    snapshot->pe_state = pe_state;
+
+    snapshot->num_snk_pdos = pdo_numb & STUSB4500_DPM_PDO_NUMB_MSK;
+    if (snapshot->num_snk_pdos > STUSB4500_NUM_SNK_PDOS)
+        snapshot->num_snk_pdos = STUSB4500_NUM_SNK_PDOS;
+    for (uint8_t i = 0; i < snapshot->num_snk_pdos; i++) {
+        snapshot->snk_pdos[i] = get_le32(&block[i * sizeof(uint32_t)]);
+    }
+
+    // RDO_STATUS keeps the last request after a hard reset or detach
+    uint32_t const rdo = get_le32(&block[RDO_OFFSET]);
+    uint8_t const position =
+      (rdo & STUSB4500_RDO_OBJECT_POSITION_MSK) >> STUSB4500_RDO_OBJECT_POSITION_POS;
+    if (!snapshot->attached || pe_state != STUSB4500_PE_SNK_READY || !position) return;
+
+    snapshot->rdo = rdo;
+    snapshot->position = position;
+    snapshot->current_ma =
+      ((rdo & STUSB4500_RDO_OPERATING_CURRENT_MSK) >> STUSB4500_RDO_OPERATING_CURRENT_POS) *
+      STUSB4500_RDO_CURRENT_RESOLUTION_MA;
+    snapshot->max_current_ma =
+      ((rdo & STUSB4500_RDO_MAX_CURRENT_MSK) >> STUSB4500_RDO_MAX_CURRENT_POS) *
+      STUSB4500_RDO_CURRENT_RESOLUTION_MA;
+
+    // The sink only requests fixed supplies
+    if (position <= monitor->num_src_pdos) {
+        uint32_t const pdo = monitor->src_pdos[position - 1];
+        if (PDO_TYPE(pdo) == PDO_TYPE_FIXED) snapshot->voltage_mv = FROM_PDO_VOLTAGE(pdo);
+    }
+}
+
+static stusb4500_port_change_t
+  diff(stusb4500_port_snapshot_t const* prev, stusb4500_port_snapshot_t const* now) {
+    stusb4500_port_change_t changes = 0;
+
+    if (prev->attached != now->attached) changes |= STUSB4500_PORT_ATTACH;
+    if (prev->pe_state != now->pe_state) changes |= STUSB4500_PORT_PE_STATE;
+    if (prev->rdo != now->rdo || prev->voltage_mv != now->voltage_mv)
+        changes |= STUSB4500_PORT_CONTRACT;
+    if (
+      prev->num_snk_pdos != now->num_snk_pdos ||
+      memcmp(prev->snk_pdos, now->snk_pdos, sizeof(now->snk_pdos)))
+        changes |= STUSB4500_PORT_SNK_PDOS;
+
+    return changes;
+}
+
+static void publish(stusb4500_monitor_t* monitor, stusb4500_port_snapshot_t const* snapshot) {
+    uint32_t words[STUSB4500_MONITOR_WORDS] = {0};
+    memcpy(words, snapshot, sizeof(*snapshot));
+
+    // Odd while the words are inconsistent, readers retry
+    uint32_t const sequence = LOAD_RELAXED(&monitor->sequence);
+    STORE_RELAXED(&monitor->sequence, sequence + 1);
+    FENCE_RELEASE();
+    for (size_t i = 0; i < STUSB4500_MONITOR_WORDS; i++) {
+        STORE_RELAXED(&monitor->words[i], words[i]);
+    }
+    // Skip 0 on wrap around, it marks a monitor without a snapshot
+    uint32_t const next = (sequence + 2 != 0) ? sequence + 2 : 2;
+    STORE_RELEASE(&monitor->sequence, next);
+}
+
+void stusb4500_monitor_init(stusb4500_monitor_t* monitor, stusb4500_t const* dev) {
+    memset(monitor, 0, sizeof(*monitor));
+    monitor->dev = dev;
+}
+
+bool stusb4500_monitor_poll(stusb4500_monitor_t* monitor) {
+    if (!monitor || !monitor->dev) return false;
+
+    uint8_t port_status;
+    uint8_t pe_state;
+    uint8_t pdo_numb;
+    uint8_t block[STATUS_BLOCK_SIZE];
+    stusb4500_msg_t const msgs[] = {
+      STUSB4500_READ_MSG(STUSB4500_REG_PORT_STATUS_1, &port_status, sizeof(port_status)),
+      STUSB4500_READ_MSG(STUSB4500_REG_PE_FSM, &pe_state, sizeof(pe_state)),
+      STUSB4500_READ_MSG(STUSB4500_REG_DPM_PDO_NUMB, &pdo_numb, sizeof(pdo_numb)),
+      STUSB4500_READ_MSG(STUSB4500_REG_DPM_SNK_PDO1, block, sizeof(block)),
+    };
+    if (!stusb4500_transfer(monitor->dev, msgs, STUSB4500_NUM_MSGS(msgs))) return false;
+
+    // The capabilities belong to the source which was unplugged
+    if (!(port_status & STUSB4500_PORT_STATUS_1_ATTACH)) monitor->num_src_pdos = 0;
+
+    stusb4500_port_snapshot_t now;
+    decode(monitor, port_status, pe_state, pdo_numb, block, &now);
+    publish(monitor, &now);
+
+    if (!monitor->valid) {
+        // Report the initial state as a change from a detached port
+        memset(&monitor->last, 0, sizeof(monitor->last));
+        monitor->valid = true;
+    }
+    stusb4500_port_change_t const changes = diff(&monitor->last, &now);
+    stusb4500_port_snapshot_t const prev = monitor->last;
+    monitor->last = now;
+
+    if (changes && monitor->on_change) monitor->on_change(&prev, &now, changes, monitor->context);
+
+    return true;
+}
+
+bool stusb4500_monitor_read(
+  stusb4500_monitor_t const* monitor, stusb4500_port_snapshot_t* snapshot) {
+    if (!monitor || !snapshot) return false;
+
+    uint32_t words[STUSB4500_MONITOR_WORDS];
+    uint32_t sequence;
+    do {
+        sequence = LOAD_ACQUIRE(&monitor->sequence);
+        for (size_t i = 0; i < STUSB4500_MONITOR_WORDS; i++) {
+            words[i] = LOAD_RELAXED(&monitor->words[i]);
+        }
+        FENCE_ACQUIRE();
+    } while ((sequence & 1UL) || sequence != LOAD_RELAXED(&monitor->sequence));
+
+    if (!sequence) return false;
+
+    memcpy(snapshot, words, sizeof(*snapshot));
+    return true;
+}
+
+void stusb4500_monitor_set_src_pdos(
+  stusb4500_monitor_t* monitor, uint32_t const* src_pdos, uint8_t num_src_pdos) {
+    if (!monitor) return;
+
+    if (!src_pdos || num_src_pdos > STUSB4500_MAX_SRC_PDOS) num_src_pdos = 0;
+    if (num_src_pdos) memcpy(monitor->src_pdos, src_pdos, num_src_pdos * sizeof(uint32_t));
+    monitor->num_src_pdos = num_src_pdos;
+}
@@ -1,4 +1,8 @@
 #include "stusb4500.h"
+#include "stusb4500_backoff.h"
+#include "stusb4500_bus.h"
+#include "stusb4500_defs.h"
+#include "stusb4500_production.h"
 
 #include <assert.h>
 #include <string.h>
@@ -31,334 +35,318 @@ FTP_CTRL_1: address 0x97
 RW_BUFFER: address 0x53
     [7:0] : Buffer used for reading and writing data */
 
-#define FTP_CUST_PASSWORD_REG 0x95UL
-#define FTP_CUST_PASSWORD 0x47UL
-#define FTP_CTRL_0 0x96UL
-#define FTP_CUST_PWR 0x80UL
-#define FTP_CUST_RST_N 0x40UL
-#define FTP_CUST_REQ 0x10UL
-#define FTP_CUST_SECT 0x07UL
-#define FTP_CTRL_1 0x97UL
-#define FTP_CUST_SER 0xF8UL
-#define FTP_CUST_OPCODE 0x07UL
-#define RW_BUFFER 0x53UL
-
-// Opcodes
-#define READ 0x00UL             // Read memory array
-#define WRITE_PL 0x01UL         // Shift in data on Program Load (PL) Register
-#define WRITE_SER 0x02UL        // Shift in data on Sector Erase (SER) Register
-#define READ_PL 0x03UL          // Shift out data on Program Load (PL) Register
-#define READ_SER 0x04UL         // Shift out data on Sector Erase (SER) Register
-#define ERASE_SECTOR 0x05UL     // Erase memory array
-#define PROG_SECTOR 0x06UL      // Program 256b word into EEPROM
-#define SOFT_PROG_SECTOR 0x07UL // Soft Program array
-
-// Sector masks
-#define SECTOR0 0x01UL
-#define SECTOR1 0x02UL
-#define SECTOR2 0x04UL
-#define SECTOR3 0x08UL
-#define SECTOR4 0x10UL
-
-// Register masks
-#define I_SNK_PDO1_POS 4UL
-#define I_SNK_PDO1_MSK (0x0FUL << I_SNK_PDO1_POS)
-#define I_SNK_PDO1_SECTOR 3UL
-#define I_SNK_PDO1_OFFSET 2UL
-
-#define I_SNK_PDO2_POS 0UL
-#define I_SNK_PDO2_MSK (0x0FUL << I_SNK_PDO2_POS)
-#define I_SNK_PDO2_SECTOR 3UL
-#define I_SNK_PDO2_OFFSET 4UL
-
-#define I_SNK_PDO3_POS 4UL
-#define I_SNK_PDO3_MSK (0x0FUL << I_SNK_PDO3_POS)
-#define I_SNK_PDO3_SECTOR 3UL
-#define I_SNK_PDO3_OFFSET 5UL
-
-#define I_SNK_PDO_FLEX_POS 2UL
-#define I_SNK_PDO_FLEX_MSK (0x03FFUL << I_SNK_PDO_FLEX_POS)
-#define I_SNK_PDO_FLEX_SECTOR 4UL
-#define I_SNK_PDO_FLEX_OFFSET 3UL
-
-#define V_SNK_PDO2_POS 6UL
-#define V_SNK_PDO2_MSK (0x01FFUL << V_SNK_PDO2_POS)
-#define V_SNK_PDO2_SECTOR 4UL
-#define V_SNK_PDO2_OFFSET 0UL
-
-#define V_SNK_PDO3_POS 0UL
-#define V_SNK_PDO3_MSK (0x01FFUL << V_SNK_PDO3_POS)
-#define V_SNK_PDO3_SECTOR 4UL
-#define V_SNK_PDO3_OFFSET 2UL
-
-#define SNK_PDO_NUMB_POS 1UL
-#define SNK_PDO_NUMB_MSK (0x03UL << SNK_PDO_NUMB_POS)
-#define SNK_PDO_NUMB_SECTOR 3UL
-#define SNK_PDO_NUMB_OFFSET 2UL
-
-#define REQ_SRC_CURRENT_POS 4UL
-#define REQ_SRC_CURRENT_MSK (1UL << REQ_SRC_CURRENT_POS)
-#define REQ_SRC_CURRENT_SECTOR 4UL
-#define REQ_SRC_CURRENT_OFFSET 6UL
-
-#define POWER_ONLY_ABOVE_5V_POS 3UL
-#define POWER_ONLY_ABOVE_5V_MSK (1UL << POWER_ONLY_ABOVE_5V_POS)
-#define POWER_ONLY_ABOVE_5V_SECTOR 4UL
-#define POWER_ONLY_ABOVE_5V_OFFSET 6UL
-
-#define GPIO_CFG_POS 4UL
-#define GPIO_CFG_MSK (0x03UL << GPIO_CFG_POS)
-#define GPIO_CFG_SECTOR 1UL
-#define GPIO_CFG_OFFSET 0UL
-
-// 5 sectors, 8 bytes each
-#define NUM_SECTORS 5UL
-#define SECTOR_SIZE 8UL
+// Maximum number of messages sent ahead of an FTP command
+#define FTP_MAX_SETUP_MSGS 3UL
+#define FTP_OPCODE(opcode) (STUSB4500_FTP_##opcode & STUSB4500_FTP_CUST_OPCODE)
+
+// Location of an NVM field
+typedef struct {
+    uint8_t sector;
+    uint8_t offset;
+    uint8_t pos;
+    uint16_t msk;
+} nvm_field_t;
+
+#define NVM_FIELD(field, sector, offset, pos, width)                                               \
+    [field] = {(sector), (offset), (pos), (uint16_t)(((1UL << (width)) - 1UL) << (pos))},
+
+// Bits outside these fields are preserved as is
+static nvm_field_t const nvm_fields[STUSB4500_NVM_NUM_FIELDS] = {STUSB4500_NVM_FIELDS(NVM_FIELD)};
+
+#define NUM_SECTORS STUSB4500_NVM_NUM_SECTORS
+#define SECTOR_SIZE STUSB4500_NVM_SECTOR_SIZE
 #define NVM_SIZE (NUM_SECTORS * SECTOR_SIZE)
 
 #define PDO_VOLTAGE(mv) ((mv) / 50UL)
 #define PDO_CURRENT(ma) (((ma)-250UL) / 250UL)
 #define PDO_CURRENT_FLEX(ma) ((ma) / 10UL)
 
-#define MODIFY_REG(reg, data, mask) reg = (((reg) & ~(mask)) | ((data) & (mask)))
+// CRC-16/CCITT-FALSE of the serialized NVM image
+#define CRC16_POLY 0x1021UL
+#define CRC16_INIT 0xFFFFUL
 
-static bool enter_write_mode(stusb4500_t const* dev) {
-    uint8_t buffer;
+// Serialized NVM image layout
+#define IMAGE_MAGIC_OFFSET 0UL
+#define IMAGE_VERSION_OFFSET 2UL
+#define IMAGE_NVM_OFFSET 3UL
+#define IMAGE_CRC_OFFSET (IMAGE_NVM_OFFSET + NVM_SIZE)
 
-    // Write FTP_CUST_PASSWORD to FTP_CUST_PASSWORD_REG
-    buffer = FTP_CUST_PASSWORD;
-    if (!dev->write(dev->addr, FTP_CUST_PASSWORD_REG, &buffer, 1, dev->context)) return false;
+// Power on sequence: reset internal controller, then set PWR and RST_N bits in FTP_CTRL_0
+static uint8_t const ftp_reset = 0x00;
+static uint8_t const ftp_power_on = STUSB4500_FTP_CUST_PWR | STUSB4500_FTP_CUST_RST_N;
 
-    // RW_BUFFER register must be NULL for Partial Erase feature
-    buffer = 0x00;
-    if (!dev->write(dev->addr, RW_BUFFER, &buffer, 1, dev->context)) return false;
+// Wait for execution of the current FTP command. Fails if it does not complete in time
+static bool wait_ftp_idle(stusb4500_t const* dev, uint8_t ctrl0) {
+    stusb4500_backoff_t backoff;
 
-    /* Begin NVM power on sequence */
-    // Reset internal controller
-    buffer = 0x00;
-    if (!dev->write(dev->addr, FTP_CTRL_0, &buffer, 1, dev->context)) return false;
+    stusb4500_backoff_start(&backoff, NULL, dev->ftp_timeout_ms, STUSB4500_FTP_MAX_DELAY_US);
 
-    // Set PWR and RST_N bits in FTP_CTRL_0
-    buffer = FTP_CUST_PWR | FTP_CUST_RST_N;
-    if (!dev->write(dev->addr, FTP_CTRL_0, &buffer, 1, dev->context)) return false;
-    /* End NVM power on sequence */
+    while (ctrl0 & STUSB4500_FTP_CUST_REQ) {
+        if (!stusb4500_backoff_poll(&backoff)) return false;
+        stusb4500_backoff_sleep(dev, &backoff);
+        if (!stusb4500_read(dev, STUSB4500_FTP_CTRL_0, &ctrl0, 1)) return false;
+    }
 
-    /* Begin sectors erase */
-    // Format and mask sectors to erase and write SER write opcode
-    buffer = (((SECTOR0 | SECTOR1 | SECTOR2 | SECTOR3 | SECTOR4) << 3) & FTP_CUST_SER) |
-             (WRITE_SER & FTP_CUST_OPCODE);
-    if (!dev->write(dev->addr, FTP_CTRL_1, &buffer, 1, dev->context)) return false;
+    METRICS_WAIT(dev, STUSB4500_WAIT_FTP_IDLE, backoff.polls);
+    return true;
+}
 
-    // Load SER write command
-    buffer = FTP_CUST_PWR | FTP_CUST_RST_N | FTP_CUST_REQ;
-    if (!dev->write(dev->addr, FTP_CTRL_0, &buffer, 1, dev->context)) return false;
+// Write the opcode to FTP_CTRL_1 and load the command. The setup messages, the command and the
+// first status poll share one bus transaction
+static bool issue_ftp_command(
+  stusb4500_t const* dev,
+  stusb4500_msg_t const* setup,
+  size_t num_setup,
+  uint8_t ctrl1,
+  uint8_t sector,
+  uint8_t* status) {
+    stusb4500_msg_t msgs[FTP_MAX_SETUP_MSGS + 3];
+    uint8_t const ctrl0 =
+      (sector & STUSB4500_FTP_CUST_SECT) | ftp_power_on | STUSB4500_FTP_CUST_REQ;
+    size_t n = 0;
+
+    if (num_setup > FTP_MAX_SETUP_MSGS) return false;
+
+    while (n < num_setup) {
+        msgs[n] = setup[n];
+        n++;
+    }
 
-    // Wait for execution
-    do {
-        if (!dev->read(dev->addr, FTP_CTRL_0, &buffer, 1, dev->context)) return false;
-    } while (buffer & FTP_CUST_REQ);
+    stusb4500_msg_t const command[] = {
+      STUSB4500_WRITE_MSG(STUSB4500_FTP_CTRL_1, &ctrl1, 1),
+      STUSB4500_WRITE_MSG(STUSB4500_FTP_CTRL_0, &ctrl0, 1),
+      STUSB4500_READ_MSG(STUSB4500_FTP_CTRL_0, status, 1),
+    };
+    for (size_t i = 0; i < STUSB4500_NUM_MSGS(command); i++) {
+        msgs[n++] = command[i];
+    }
 
-    // Write soft program opcode
-    buffer = SOFT_PROG_SECTOR & FTP_CUST_OPCODE;
-    if (!dev->write(dev->addr, FTP_CTRL_1, &buffer, 1, dev->context)) return false;
+    return stusb4500_transfer(dev, msgs, n);
+}
 
-    // Load soft program command
-    buffer = FTP_CUST_PWR | FTP_CUST_RST_N | FTP_CUST_REQ;
-    if (!dev->write(dev->addr, FTP_CTRL_0, &buffer, 1, dev->context)) return false;
+// Issue a command and wait for its execution
+static bool run_ftp_command(
+  stusb4500_t const* dev,
+  stusb4500_msg_t const* setup,
+  size_t num_setup,
+  uint8_t ctrl1,
+  uint8_t sector) {
+    uint8_t status;
+    bool ok;
+
+    // Keep other accesses to the bus out until the command has completed
+    stusb4500_lock(dev);
+    ok = issue_ftp_command(dev, setup, num_setup, ctrl1, sector, &status) &&
+         wait_ftp_idle(dev, status);
+    stusb4500_unlock(dev);
+
+    return ok;
+}
+
+// Unlock the NVM and load the mask of the sectors to erase
+static bool load_erase_sectors(stusb4500_t const* dev, uint8_t sectors) {
+    // Write FTP_CUST_PASSWORD to FTP_CUST_PASSWORD_REG and reset the internal controller, the
+    // registers are adjacent
+    uint8_t const unlock[] = {STUSB4500_FTP_CUST_PASSWORD, ftp_reset};
+    // RW_BUFFER register must be NULL for Partial Erase feature
+    uint8_t const rw_buffer = 0x00;
+
+    stusb4500_msg_t const setup[] = {
+      STUSB4500_WRITE_MSG(STUSB4500_FTP_CUST_PASSWORD_REG, unlock, sizeof(unlock)),
+      STUSB4500_WRITE_MSG(STUSB4500_RW_BUFFER, &rw_buffer, 1),
+      STUSB4500_WRITE_MSG(STUSB4500_FTP_CTRL_0, &ftp_power_on, 1),
+    };
+
+    // Format and mask sectors to erase and load SER write command
+    return run_ftp_command(
+      dev,
+      setup,
+      STUSB4500_NUM_MSGS(setup),
+      ((sectors << 3) & STUSB4500_FTP_CUST_SER) | FTP_OPCODE(WRITE_SER),
+      0);
+}
 
-    // Wait for execution
-    do {
-        if (!dev->read(dev->addr, FTP_CTRL_0, &buffer, 1, dev->context)) return false;
-    } while (buffer & FTP_CUST_REQ);
+static bool enter_write_mode(stusb4500_t const* dev, uint8_t sectors) {
+    /* Begin sectors erase */
+    if (!load_erase_sectors(dev, sectors)) return false;
 
-    // Write erase sectors opcode
-    buffer = ERASE_SECTOR & FTP_CUST_OPCODE;
-    if (!dev->write(dev->addr, FTP_CTRL_1, &buffer, 1, dev->context)) return false;
+    // Load soft program command
+    if (!run_ftp_command(dev, NULL, 0, FTP_OPCODE(SOFT_PROG_SECTOR), 0)) return false;
 
     // Load erase sectors command
-    buffer = FTP_CUST_PWR | FTP_CUST_RST_N | FTP_CUST_REQ;
-    if (!dev->write(dev->addr, FTP_CTRL_0, &buffer, 1, dev->context)) return false;
-
-    // Wait for execution
-    do {
-        if (!dev->read(dev->addr, FTP_CTRL_0, &buffer, 1, dev->context)) return false;
-    } while (buffer & FTP_CUST_REQ);
+    if (!run_ftp_command(dev, NULL, 0, FTP_OPCODE(ERASE_SECTOR), 0)) return false;
     /* End sectors erase */
 
     return true;
 }
 
 static bool enter_read_mode(stusb4500_t const* dev) {
-    uint8_t buffer;
-
-    // Write FTP_CUST_PASSWORD to FTP_CUST_PASSWORD_REG
-    buffer = FTP_CUST_PASSWORD;
-    if (!dev->write(dev->addr, FTP_CUST_PASSWORD_REG, &buffer, 1, dev->context)) return false;
-
-    /* Begin NVM power on sequence */
-    // Reset internal controller
-    buffer = 0x00;
-    if (!dev->write(dev->addr, FTP_CTRL_0, &buffer, 1, dev->context)) return false;
+    // Write FTP_CUST_PASSWORD to FTP_CUST_PASSWORD_REG, then NVM power on sequence
+    uint8_t const unlock[] = {STUSB4500_FTP_CUST_PASSWORD, ftp_reset};
 
-    // Set PWR and RST_N bits in FTP_CTRL_0
-    buffer = FTP_CUST_PWR | FTP_CUST_RST_N;
-    if (!dev->write(dev->addr, FTP_CTRL_0, &buffer, 1, dev->context)) return false;
-    /* End NVM power on sequence */
+    stusb4500_msg_t const msgs[] = {
+      STUSB4500_WRITE_MSG(STUSB4500_FTP_CUST_PASSWORD_REG, unlock, sizeof(unlock)),
+      STUSB4500_WRITE_MSG(STUSB4500_FTP_CTRL_0, &ftp_power_on, 1),
+    };
 
-    return true;
+    return stusb4500_transfer(dev, msgs, STUSB4500_NUM_MSGS(msgs));
 }
 
 static bool read_sector(stusb4500_t const* dev, uint8_t sector, uint8_t* sector_data) {
     if (!sector_data) return false;
 
-    uint8_t buffer;
-
-    // Set PWR and RST_N bits in FTP_CTRL_0
-    buffer = FTP_CUST_PWR | FTP_CUST_RST_N;
-    if (!dev->write(dev->addr, FTP_CTRL_0, &buffer, 1, dev->context)) return false;
-
-    // Write sector read opcode
-    buffer = (READ & FTP_CUST_OPCODE);
-    if (!dev->write(dev->addr, FTP_CTRL_1, &buffer, 1, dev->context)) return false;
-
     // Select sector to read and load sector read command
-    buffer = (sector & FTP_CUST_SECT) | FTP_CUST_PWR | FTP_CUST_RST_N | FTP_CUST_REQ;
-    if (!dev->write(dev->addr, FTP_CTRL_0, &buffer, 1, dev->context)) return false;
+    stusb4500_msg_t const setup[] = {
+      STUSB4500_WRITE_MSG(STUSB4500_FTP_CTRL_0, &ftp_power_on, 1),
+    };
+    if (!run_ftp_command(dev, setup, STUSB4500_NUM_MSGS(setup), FTP_OPCODE(READ), sector))
+        return false;
+
+    // Read sector data bytes from RW_BUFFER register and reset internal controller
+    stusb4500_msg_t const msgs[] = {
+      STUSB4500_READ_MSG(STUSB4500_RW_BUFFER, sector_data, SECTOR_SIZE),
+      STUSB4500_WRITE_MSG(STUSB4500_FTP_CTRL_0, &ftp_reset, 1),
+    };
+
+    return stusb4500_transfer(dev, msgs, STUSB4500_NUM_MSGS(msgs));
+}
 
-    // Wait for execution
-    do {
-        if (!dev->read(dev->addr, FTP_CTRL_0, &buffer, 1, dev->context)) return false;
-    } while (buffer & FTP_CUST_REQ);
+// Write the 8 byte programming data to the RW_BUFFER register and load PL write command
+static bool load_sector(stusb4500_t const* dev, uint8_t const* sector_data) {
+    stusb4500_msg_t const setup[] = {
+      STUSB4500_WRITE_MSG(STUSB4500_RW_BUFFER, sector_data, SECTOR_SIZE),
+      STUSB4500_WRITE_MSG(STUSB4500_FTP_CTRL_0, &ftp_power_on, 1),
+    };
 
-    // Read sector data bytes from RW_BUFFER register
-    if (!dev->read(dev->addr, RW_BUFFER, sector_data, 8, dev->context)) return false;
+    return run_ftp_command(dev, setup, STUSB4500_NUM_MSGS(setup), FTP_OPCODE(WRITE_PL), 0);
+}
 
-    // Reset internal controller
-    buffer = 0x00;
-    if (!dev->write(dev->addr, FTP_CTRL_0, &buffer, 1, dev->context)) return false;
+static bool write_sector(stusb4500_t const* dev, uint8_t sector_num, uint8_t const* sector_data) {
+    if (!sector_data || !load_sector(dev, sector_data)) return false;
 
-    return true;
+    // Load program sector command
+    return run_ftp_command(dev, NULL, 0, FTP_OPCODE(PROG_SECTOR), sector_num);
 }
 
-static bool write_sector(stusb4500_t const* dev, uint8_t sector_num, uint8_t const* sector_data) {
-    if (!sector_data) return false;
+static bool exit_rw_mode(stusb4500_t const* dev) {
+    // Clear FTP_CTRL registers, then clear password
+    uint8_t const ctrl[] = {STUSB4500_FTP_CUST_RST_N, 0x00};
+    uint8_t const password = 0x00;
 
-    uint8_t buffer;
+    stusb4500_msg_t const msgs[] = {
+      STUSB4500_WRITE_MSG(STUSB4500_FTP_CTRL_0, ctrl, sizeof(ctrl)),
+      STUSB4500_WRITE_MSG(STUSB4500_FTP_CUST_PASSWORD_REG, &password, 1),
+    };
 
-    // Write the 8 byte programming data to the RW_BUFFER register
-    if (!dev->write(dev->addr, RW_BUFFER, sector_data, 8, dev->context)) return false;
+    return stusb4500_transfer(dev, msgs, STUSB4500_NUM_MSGS(msgs));
+}
 
-    // Set PWR and RST_N bits in FTP_CTRL_0
-    buffer = FTP_CUST_PWR | FTP_CUST_RST_N;
-    if (!dev->write(dev->addr, FTP_CTRL_0, &buffer, 1, dev->context)) return false;
+static uint16_t field_word(uint8_t const* nvm, nvm_field_t const* f) {
+    uint8_t const* p = &nvm[f->sector * SECTOR_SIZE + f->offset];
 
-    // Write PL write opcode
-    buffer = (WRITE_PL & FTP_CUST_OPCODE);
-    if (!dev->write(dev->addr, FTP_CTRL_1, &buffer, 1, dev->context)) return false;
+    return (f->msk > 0xFFU) ? (uint16_t)(p[0] | (p[1] << 8)) : p[0];
+}
 
-    // Load PL write command
-    buffer = FTP_CUST_PWR | FTP_CUST_RST_N | FTP_CUST_REQ;
-    if (!dev->write(dev->addr, FTP_CTRL_0, &buffer, 1, dev->context)) return false;
+bool stusb4500_nvm_get(uint8_t const* nvm, stusb4500_nvm_field_t field, uint16_t* value) {
+    if (!nvm || !value || field >= STUSB4500_NVM_NUM_FIELDS) return false;
 
-    // Wait for execution
-    do {
-        if (!dev->read(dev->addr, FTP_CTRL_0, &buffer, 1, dev->context)) return false;
-    } while (buffer & FTP_CUST_REQ);
+    nvm_field_t const* f = &nvm_fields[field];
+    *value = (uint16_t)((field_word(nvm, f) & f->msk) >> f->pos);
+    return true;
+}
 
-    // Write program sector opcode
-    buffer = (PROG_SECTOR & FTP_CUST_OPCODE);
-    if (!dev->write(dev->addr, FTP_CTRL_1, &buffer, 1, dev->context)) return false;
+bool stusb4500_nvm_set(uint8_t* nvm, stusb4500_nvm_field_t field, uint16_t value) {
+    if (!nvm || field >= STUSB4500_NVM_NUM_FIELDS) return false;
 
-    // Load program sector command
-    buffer = (sector_num & FTP_CUST_SECT) | FTP_CUST_PWR | FTP_CUST_RST_N | FTP_CUST_REQ;
-    if (!dev->write(dev->addr, FTP_CTRL_0, &buffer, 1, dev->context)) return false;
+    nvm_field_t const* f = &nvm_fields[field];
+    if (((uint32_t)value << f->pos) & ~(uint32_t)f->msk) return false;
 
-    // Wait for execution
-    do {
-        if (!dev->read(dev->addr, FTP_CTRL_0, &buffer, 1, dev->context)) return false;
-    } while (buffer & FTP_CUST_REQ);
+    uint16_t const word = (uint16_t)((field_word(nvm, f) & ~f->msk) | (value << f->pos));
+    uint8_t* p = &nvm[f->sector * SECTOR_SIZE + f->offset];
 
+    p[0] = (uint8_t)word;
+    if (f->msk > 0xFFU) p[1] = (uint8_t)(word >> 8);
     return true;
 }
 
-static bool exit_rw_mode(stusb4500_t const* dev) {
-    uint8_t buffer;
+uint8_t stusb4500_nvm_field_sectors(stusb4500_nvm_field_t field) {
+    if (field >= STUSB4500_NVM_NUM_FIELDS) return 0;
 
-    // Clear FTP_CTRL registers
-    buffer = FTP_CUST_RST_N;
-    if (!dev->write(dev->addr, FTP_CTRL_0, &buffer, 1, dev->context)) return false;
-    buffer = 0x00;
-    if (!dev->write(dev->addr, FTP_CTRL_1, &buffer, 1, dev->context)) return false;
+    return (uint8_t)STUSB4500_NVM_SECTOR(nvm_fields[field].sector);
+}
 
-    // Clear password
-    buffer = 0x00;
-    if (!dev->write(dev->addr, FTP_CUST_PASSWORD_REG, &buffer, 1, dev->context)) return false;
+// Out of range values are truncated to the field width
+static void set_field(uint8_t* nvm, stusb4500_nvm_field_t field, uint32_t value) {
+    nvm_field_t const* f = &nvm_fields[field];
 
-    return true;
+    stusb4500_nvm_set(nvm, field, (uint16_t)(value & (f->msk >> f->pos)));
 }
 
-static void apply_config(uint8_t* nvm, stusb4500_nvm_config_t const* config) {
-    uint8_t(*p_nvm)[SECTOR_SIZE] = (uint8_t(*)[SECTOR_SIZE])nvm;
+void stusb4500_nvm_apply_config(uint8_t* nvm, stusb4500_nvm_config_t const* config) {
+    if (!nvm || !config) return;
+
+    set_field(nvm, STUSB4500_NVM_I_SNK_PDO1, PDO_CURRENT(config->pdo1_current_ma));
+    set_field(nvm, STUSB4500_NVM_I_SNK_PDO2, PDO_CURRENT(config->pdo2_current_ma));
+    set_field(nvm, STUSB4500_NVM_I_SNK_PDO3, PDO_CURRENT(config->pdo3_current_ma));
+    set_field(
+      nvm, STUSB4500_NVM_I_SNK_PDO_FLEX, PDO_CURRENT_FLEX(config->pdo_current_fallback));
+    set_field(nvm, STUSB4500_NVM_V_SNK_PDO2, PDO_VOLTAGE(config->pdo2_voltage_mv));
+    set_field(nvm, STUSB4500_NVM_V_SNK_PDO3, PDO_VOLTAGE(config->pdo3_voltage_mv));
+    set_field(nvm, STUSB4500_NVM_SNK_PDO_NUMB, config->num_valid_pdos);
+    set_field(nvm, STUSB4500_NVM_REQ_SRC_CURRENT, config->use_src_current);
+    set_field(nvm, STUSB4500_NVM_POWER_ONLY_ABOVE_5V, config->only_above_5v);
+    set_field(nvm, STUSB4500_NVM_GPIO_CFG, config->gpio_cfg);
+}
 
-    MODIFY_REG(
-      p_nvm[I_SNK_PDO1_SECTOR][I_SNK_PDO1_OFFSET],
-      (PDO_CURRENT(config->pdo1_current_ma) << I_SNK_PDO1_POS) & I_SNK_PDO1_MSK,
-      I_SNK_PDO1_MSK);
+static uint16_t crc16(uint8_t const* data, size_t len) {
+    uint16_t crc = CRC16_INIT;
 
-    MODIFY_REG(
-      p_nvm[I_SNK_PDO2_SECTOR][I_SNK_PDO2_OFFSET],
-      (PDO_CURRENT(config->pdo2_current_ma) << I_SNK_PDO2_POS) & I_SNK_PDO2_MSK,
-      I_SNK_PDO2_MSK);
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)(data[i] << 8);
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000U) ? (uint16_t)((crc << 1) ^ CRC16_POLY) : (uint16_t)(crc << 1);
+        }
+    }
 
-    MODIFY_REG(
-      p_nvm[I_SNK_PDO3_SECTOR][I_SNK_PDO3_OFFSET],
-      (PDO_CURRENT(config->pdo3_current_ma) << I_SNK_PDO3_POS) & I_SNK_PDO3_MSK,
-      I_SNK_PDO3_MSK);
+    return crc;
+}
 
-    MODIFY_REG(
-      *((uint16_t*)&p_nvm[I_SNK_PDO_FLEX_SECTOR][I_SNK_PDO_FLEX_OFFSET]),
-      (PDO_CURRENT_FLEX(config->pdo_current_fallback) << I_SNK_PDO_FLEX_POS) & I_SNK_PDO_FLEX_MSK,
-      I_SNK_PDO_FLEX_MSK);
+bool stusb4500_nvm_image_pack(uint8_t const* nvm, uint8_t* image) {
+    if (!nvm || !image) return false;
 
-    MODIFY_REG(
-      *((uint16_t*)&p_nvm[V_SNK_PDO2_SECTOR][V_SNK_PDO2_OFFSET]),
-      (PDO_VOLTAGE(config->pdo2_voltage_mv) << V_SNK_PDO2_POS) & V_SNK_PDO2_MSK,
-      V_SNK_PDO2_MSK);
+    image[IMAGE_MAGIC_OFFSET] = (uint8_t)STUSB4500_NVM_IMAGE_MAGIC;
+    image[IMAGE_MAGIC_OFFSET + 1] = (uint8_t)(STUSB4500_NVM_IMAGE_MAGIC >> 8);
+    image[IMAGE_VERSION_OFFSET] = STUSB4500_NVM_IMAGE_VERSION;
+    memcpy(&image[IMAGE_NVM_OFFSET], nvm, NVM_SIZE);
 
-    MODIFY_REG(
-      *((uint16_t*)&p_nvm[V_SNK_PDO3_SECTOR][V_SNK_PDO3_OFFSET]),
-      (PDO_VOLTAGE(config->pdo3_voltage_mv) << V_SNK_PDO3_POS) & V_SNK_PDO3_MSK,
-      V_SNK_PDO3_MSK);
+    uint16_t const crc = crc16(image, IMAGE_CRC_OFFSET);
+    image[IMAGE_CRC_OFFSET] = (uint8_t)crc;
+    image[IMAGE_CRC_OFFSET + 1] = (uint8_t)(crc >> 8);
+    return true;
+}
 
-    MODIFY_REG(
-      p_nvm[SNK_PDO_NUMB_SECTOR][SNK_PDO_NUMB_OFFSET],
-      (config->num_valid_pdos << SNK_PDO_NUMB_POS) & SNK_PDO_NUMB_MSK,
-      SNK_PDO_NUMB_MSK);
+bool stusb4500_nvm_image_unpack(uint8_t const* image, uint8_t* nvm) {
+    if (!image || !nvm) return false;
 
-    MODIFY_REG(
-      p_nvm[REQ_SRC_CURRENT_SECTOR][REQ_SRC_CURRENT_OFFSET],
-      (config->use_src_current << REQ_SRC_CURRENT_POS) & REQ_SRC_CURRENT_MSK,
-      REQ_SRC_CURRENT_MSK);
+    uint16_t const magic =
+      (uint16_t)(image[IMAGE_MAGIC_OFFSET] | (image[IMAGE_MAGIC_OFFSET + 1] << 8));
+    uint16_t const crc = (uint16_t)(image[IMAGE_CRC_OFFSET] | (image[IMAGE_CRC_OFFSET + 1] << 8));
 
-    MODIFY_REG(
-      p_nvm[POWER_ONLY_ABOVE_5V_SECTOR][POWER_ONLY_ABOVE_5V_OFFSET],
-      (config->only_above_5v << POWER_ONLY_ABOVE_5V_POS) & POWER_ONLY_ABOVE_5V_MSK,
-      POWER_ONLY_ABOVE_5V_MSK);
+    if (magic != STUSB4500_NVM_IMAGE_MAGIC) return false;
+    if (image[IMAGE_VERSION_OFFSET] != STUSB4500_NVM_IMAGE_VERSION) return false;
+    if (crc != crc16(image, IMAGE_CRC_OFFSET)) return false;
 
-    MODIFY_REG(
-      p_nvm[GPIO_CFG_SECTOR][GPIO_CFG_OFFSET],
-      (config->gpio_cfg << GPIO_CFG_POS) & GPIO_CFG_MSK,
-      GPIO_CFG_MSK);
+    memcpy(nvm, &image[IMAGE_NVM_OFFSET], NVM_SIZE);
+    return true;
 }
 
-bool stusb4500_nvm_read(stusb4500_t const* dev, uint8_t* nvm) {
-    if (!nvm) return false;
-
+// Read the sectors selected by the sector mask into their place in the NVM image
+static bool read_sectors(stusb4500_t const* dev, uint8_t sectors, uint8_t* nvm) {
     if (!enter_read_mode(dev)) return false;
 
     uint8_t* p_nvm = nvm;
     for (uint8_t sector = 0; sector < NUM_SECTORS; sector++) {
-        if (!read_sector(dev, sector, p_nvm)) return false;
+        if ((sectors & (1U << sector)) && !read_sector(dev, sector, p_nvm)) return false;
         p_nvm += SECTOR_SIZE;
     }
 
@@ -367,30 +355,317 @@ bool stusb4500_nvm_read(stusb4500_t const* dev, uint8_t* nvm) {
     return true;
 }
 
-bool stusb4500_nvm_flash(stusb4500_t const* dev, stusb4500_nvm_config_t const* config) {
+// Mask of the sectors which differ between two NVM images
+static uint8_t changed_sectors(uint8_t const* nvm, uint8_t const* image) {
+    uint8_t sectors = 0;
+
+    for (uint8_t sector = 0; sector < NUM_SECTORS; sector++) {
+        if (memcmp(&image[sector * SECTOR_SIZE], &nvm[sector * SECTOR_SIZE], SECTOR_SIZE) != 0)
+            sectors |= 1U << sector;
+    }
+
+    return sectors;
+}
+
+bool stusb4500_nvm_read(stusb4500_t const* dev, uint8_t* nvm) {
+    if (!nvm) return false;
+
+    return read_sectors(dev, STUSB4500_NVM_ALL_SECTORS, nvm);
+}
+
+bool stusb4500_nvm_read_sectors(stusb4500_t const* dev, uint8_t sectors, uint8_t* nvm) {
+    if (!nvm || !sectors || (sectors & ~STUSB4500_NVM_ALL_SECTORS)) return false;
+
+    return read_sectors(dev, sectors, nvm);
+}
+
+bool stusb4500_nvm_read_field(
+  stusb4500_t const* dev, stusb4500_nvm_field_t field, uint16_t* value) {
+    uint8_t nvm[NVM_SIZE];
+    uint8_t const sectors = stusb4500_nvm_field_sectors(field);
+
+    if (!value || !sectors) return false;
+
+    if (!read_sectors(dev, sectors, nvm)) return false;
+
+    return stusb4500_nvm_get(nvm, field, value);
+}
+
+bool stusb4500_nvm_audit(
+  stusb4500_t const* dev,
+  uint8_t const* image,
+  stusb4500_nvm_field_t const* fields,
+  size_t num_fields,
+  uint32_t* mismatches) {
+    uint8_t golden[NVM_SIZE];
+    uint8_t nvm[NVM_SIZE];
+    uint8_t sectors = 0;
+
+    if (!mismatches || !stusb4500_nvm_image_unpack(image, golden)) return false;
+    if (!fields) num_fields = STUSB4500_NVM_NUM_FIELDS;
+
+    for (size_t i = 0; i < num_fields; i++) {
+        uint8_t const field_sectors = stusb4500_nvm_field_sectors(fields ? fields[i] : i);
+        if (!field_sectors) return false;
+        sectors |= field_sectors;
+    }
+
+    *mismatches = 0;
+    if (!sectors) return true;
+
+    if (!read_sectors(dev, sectors, nvm)) return false;
+
+    for (size_t i = 0; i < num_fields; i++) {
+        stusb4500_nvm_field_t const field = fields ? fields[i] : (stusb4500_nvm_field_t)i;
+        uint16_t expected;
+        uint16_t actual;
+
+        stusb4500_nvm_get(golden, field, &expected);
+        stusb4500_nvm_get(nvm, field, &actual);
+        if (actual != expected) *mismatches |= 1UL << field;
+    }
+
+    return true;
+}
+
+static bool flash_config(stusb4500_t const* dev, stusb4500_nvm_config_t const* config) {
     uint8_t nvm[NUM_SECTORS][SECTOR_SIZE];
     uint8_t nvm_modified[NUM_SECTORS][SECTOR_SIZE];
-
-    if (!config) return false;
+    uint32_t start = METRICS_NOW(dev);
 
     if (!stusb4500_nvm_read(dev, (uint8_t*)nvm)) return false;
+    METRICS_PHASE(dev, STUSB4500_PHASE_NVM_READ, start);
 
     memcpy(nvm_modified, nvm, NVM_SIZE);
-    apply_config((uint8_t*)nvm_modified, config);
+    stusb4500_nvm_apply_config((uint8_t*)nvm_modified, config);
+
+    // Only erase, program and verify the sectors touched by the configuration
+    uint8_t const sectors = changed_sectors((uint8_t*)nvm, (uint8_t*)nvm_modified);
 
-    if (memcmp(nvm_modified, nvm, NVM_SIZE) == 0) return exit_rw_mode(dev);
+    if (!sectors) return exit_rw_mode(dev);
 
-    if (!enter_write_mode(dev)) return false;
+    start = METRICS_NOW(dev);
+    if (!enter_write_mode(dev, sectors)) return false;
+    METRICS_PHASE(dev, STUSB4500_PHASE_NVM_ERASE, start);
 
-    uint8_t* p_nvm = (uint8_t*)nvm_modified;
+    start = METRICS_NOW(dev);
     for (uint8_t sector = 0; sector < NUM_SECTORS; sector++) {
-        if (!write_sector(dev, sector, p_nvm)) return false;
-        p_nvm += SECTOR_SIZE;
+        if ((sectors & (1U << sector)) && !write_sector(dev, sector, nvm_modified[sector]))
+            return false;
     }
+    METRICS_PHASE(dev, STUSB4500_PHASE_NVM_PROGRAM, start);
 
+    start = METRICS_NOW(dev);
     if (!exit_rw_mode(dev)) return false;
 
-    if (!stusb4500_nvm_read(dev, (uint8_t*)nvm)) return false;
+    if (!read_sectors(dev, sectors, (uint8_t*)nvm)) return false;
+    METRICS_PHASE(dev, STUSB4500_PHASE_NVM_VERIFY, start);
 
     return (memcmp(nvm, nvm_modified, NVM_SIZE) == 0);
 }
+
+bool stusb4500_nvm_flash(stusb4500_t const* dev, stusb4500_nvm_config_t const* config) {
+    uint32_t const start = METRICS_NOW(dev);
+
+    if (!config) return false;
+
+    bool const ok = flash_config(dev, config);
+    METRICS_PHASE(dev, STUSB4500_PHASE_NVM_FLASH, start);
+
+    return ok;
+}
+
+bool stusb4500_nvm_flash_image(stusb4500_t const* dev, uint8_t const* image) {
+    uint8_t nvm[NUM_SECTORS][SECTOR_SIZE];
+    uint8_t nvm_readback[NUM_SECTORS][SECTOR_SIZE];
+
+    if (!stusb4500_nvm_image_unpack(image, (uint8_t*)nvm)) return false;
+
+    if (!enter_write_mode(dev, STUSB4500_NVM_ALL_SECTORS)) return false;
+
+    for (uint8_t sector = 0; sector < NUM_SECTORS; sector++) {
+        if (!write_sector(dev, sector, nvm[sector])) return false;
+    }
+
+    if (!exit_rw_mode(dev)) return false;
+
+    if (!read_sectors(dev, STUSB4500_NVM_ALL_SECTORS, (uint8_t*)nvm_readback)) return false;
+
+    return (memcmp(nvm_readback, nvm, NVM_SIZE) == 0);
+}
+
+// Production unit states, see stusb4500_production_flash()
+enum {
+    UNIT_READ,
+    UNIT_BEGIN,
+    UNIT_SOFT_PROG,
+    UNIT_ERASE,
+    UNIT_PROGRAM,
+    UNIT_DONE,
+};
+
+// Next sector to program after the given one, NUM_SECTORS if none
+static uint8_t next_sector(uint8_t sectors, uint8_t sector) {
+    while (sector < NUM_SECTORS && !(sectors & (1U << sector))) {
+        sector++;
+    }
+
+    return sector;
+}
+
+static bool finish_unit(stusb4500_production_unit_t* unit) {
+    if (!exit_rw_mode(unit->dev)) return false;
+    if (!read_sectors(unit->dev, unit->sectors, unit->nvm)) return false;
+
+    return (memcmp(unit->nvm, unit->image, NVM_SIZE) == 0);
+}
+
+// Issue a command which the unit executes while the other units are served
+static bool issue_unit_command(
+  stusb4500_production_unit_t* unit,
+  stusb4500_get_ms_func_t get_ms,
+  uint8_t ctrl1,
+  uint8_t sector) {
+    // No delays, the other units fill the time
+    stusb4500_backoff_start(&unit->backoff, get_ms, unit->dev->ftp_timeout_ms, 0);
+
+    return issue_ftp_command(unit->dev, NULL, 0, ctrl1, sector, &unit->ctrl0);
+}
+
+// Advance a unit by one step. Long FTP commands are only issued here, the unit is left to execute
+// them while the other units are served. Returns false on failure
+static bool step_unit(
+  stusb4500_production_unit_t* unit,
+  stusb4500_nvm_config_t const* config,
+  stusb4500_get_ms_func_t get_ms) {
+    stusb4500_t const* dev = unit->dev;
+
+    // Still executing the last command
+    if (unit->ctrl0 & STUSB4500_FTP_CUST_REQ) {
+        return stusb4500_backoff_poll(&unit->backoff) &&
+               stusb4500_read(dev, STUSB4500_FTP_CTRL_0, &unit->ctrl0, 1);
+    }
+
+    switch (unit->state) {
+    case UNIT_READ:
+        if (!stusb4500_nvm_read(dev, unit->nvm)) return false;
+
+        memcpy(unit->image, unit->nvm, NVM_SIZE);
+        stusb4500_nvm_apply_config(unit->image, config);
+        unit->sectors = changed_sectors(unit->nvm, unit->image);
+        if (!unit->sectors) {
+            unit->pass = true;
+            unit->state = UNIT_DONE;
+            return exit_rw_mode(dev);
+        }
+        // fall through
+
+    case UNIT_BEGIN:
+        // Begin sectors erase
+        if (!load_erase_sectors(dev, unit->sectors)) return false;
+        unit->state = UNIT_SOFT_PROG;
+        return issue_unit_command(unit, get_ms, FTP_OPCODE(SOFT_PROG_SECTOR), 0);
+
+    case UNIT_SOFT_PROG:
+        unit->state = UNIT_ERASE;
+        return issue_unit_command(unit, get_ms, FTP_OPCODE(ERASE_SECTOR), 0);
+
+    case UNIT_ERASE:
+    case UNIT_PROGRAM:
+        // Program the changed sectors one after the other once they are erased
+        unit->sector =
+          next_sector(unit->sectors, (unit->state == UNIT_ERASE) ? 0 : unit->sector + 1);
+        if (unit->sector < NUM_SECTORS) {
+            if (!load_sector(dev, &unit->image[unit->sector * SECTOR_SIZE])) return false;
+            unit->state = UNIT_PROGRAM;
+            return issue_unit_command(unit, get_ms, FTP_OPCODE(PROG_SECTOR), unit->sector);
+        }
+
+        unit->pass = finish_unit(unit);
+        unit->state = UNIT_DONE;
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// Flash the config, or the NVM image if config is NULL
+static bool run_production(
+  stusb4500_production_t* production,
+  stusb4500_nvm_config_t const* config,
+  uint8_t const* nvm) {
+
+    uint32_t const start = production->get_ms ? production->get_ms() : 0;
+    size_t channel = 0;
+    bool selected = false;
+    bool pass = true;
+    size_t pending = production->num_units;
+
+    for (size_t i = 0; i < production->num_units; i++) {
+        stusb4500_production_unit_t* unit = &production->units[i];
+
+        unit->pass = false;
+        unit->sectors = 0;
+        unit->elapsed_ms = 0;
+        unit->ctrl0 = 0;
+        unit->state = UNIT_READ;
+
+        // A complete image is programmed without reading the NVM first
+        if (!config) {
+            memcpy(unit->image, nvm, NVM_SIZE);
+            unit->sectors = STUSB4500_NVM_ALL_SECTORS;
+            unit->state = UNIT_BEGIN;
+        }
+    }
+
+    // Serve the units in turn, one step each
+    while (pending) {
+        for (size_t i = 0; i < production->num_units; i++) {
+            stusb4500_production_unit_t* unit = &production->units[i];
+            bool ok;
+
+            if (unit->state == UNIT_DONE) continue;
+
+            if (production->select_channel && (!selected || channel != unit->channel)) {
+                selected = production->select_channel(unit->channel, production->context);
+                channel = unit->channel;
+            }
+
+            ok = selected || !production->select_channel;
+            ok = ok && step_unit(unit, config, production->get_ms);
+            if (!ok) {
+                // Lock the NVM again, the unit failed. Try the channel once more if it could not be
+                // selected, the commands must not reach the unit behind another channel
+                if (production->select_channel && !selected)
+                    selected = production->select_channel(unit->channel, production->context);
+                if (selected || !production->select_channel) exit_rw_mode(unit->dev);
+                unit->state = UNIT_DONE;
+            }
+
+            if (unit->state != UNIT_DONE) continue;
+
+            if (production->get_ms) unit->elapsed_ms = production->get_ms() - start;
+            pass = pass && unit->pass;
+            pending--;
+        }
+    }
+
+    return pass;
+}
+
+bool stusb4500_production_flash(
+  stusb4500_production_t* production, stusb4500_nvm_config_t const* config) {
+    if (!production || !production->units || !config) return false;
+
+    return run_production(production, config, NULL);
+}
+
+bool stusb4500_production_flash_image(stusb4500_production_t* production, uint8_t const* image) {
+    uint8_t nvm[NVM_SIZE];
+
+    if (!production || !production->units) return false;
+    if (!stusb4500_nvm_image_unpack(image, nvm)) return false;
+
+    return run_production(production, NULL, nvm);
+}
@@ -0,0 +1,210 @@
+#include "stusb4500_pdo.h"
+
+#include <string.h>
+
+// Highest power wins, see stusb4500_policy_t
+static stusb4500_score_term_t const default_terms[] = {
+  {STUSB4500_SCORE_POWER, 1},
+};
+static stusb4500_policy_t const default_policy = {
+  default_terms,
+  sizeof(default_terms) / sizeof(default_terms[0]),
+  0,
+};
+
+bool stusb4500_pdo_decode(uint32_t pdo, stusb4500_src_pdo_t* decoded) {
+    if (!decoded) return false;
+
+    memset(decoded, 0, sizeof(*decoded));
+
+    switch (PDO_TYPE(pdo)) {
+    case PDO_TYPE_FIXED:
+        decoded->type = STUSB4500_PDO_FIXED;
+        decoded->min_voltage_mv = FROM_PDO_VOLTAGE(pdo);
+        decoded->max_voltage_mv = decoded->min_voltage_mv;
+        decoded->max_current_ma = FROM_PDO_CURRENT(pdo);
+        break;
+    case PDO_TYPE_VARIABLE:
+        decoded->type = STUSB4500_PDO_VARIABLE;
+        decoded->min_voltage_mv = FROM_PDO_VOLTAGE(pdo);
+        decoded->max_voltage_mv = FROM_PDO_MAX_VOLTAGE(pdo);
+        decoded->max_current_ma = FROM_PDO_CURRENT(pdo);
+        break;
+    case PDO_TYPE_BATTERY:
+        decoded->type = STUSB4500_PDO_BATTERY;
+        decoded->min_voltage_mv = FROM_PDO_VOLTAGE(pdo);
+        decoded->max_voltage_mv = FROM_PDO_MAX_VOLTAGE(pdo);
+        decoded->max_power_mw = FROM_PDO_POWER(pdo);
+        return true;
+#ifdef USBPD_REV30_SUPPORT
+    case PDO_TYPE_APDO:
+        if (APDO_TYPE(pdo) != APDO_TYPE_PPS) return false;
+        decoded->type = STUSB4500_PDO_PPS;
+        decoded->min_voltage_mv = FROM_PPS_MIN_VOLTAGE(pdo);
+        decoded->max_voltage_mv = FROM_PPS_MAX_VOLTAGE(pdo);
+        decoded->max_current_ma = FROM_PPS_CURRENT(pdo);
+        break;
+#endif // USBPD_REV30_SUPPORT
+    default:
+        return false;
+    }
+
+    decoded->max_power_mw =
+      (stusb4500_power_t)decoded->max_voltage_mv * decoded->max_current_ma / 1000UL;
+    return true;
+}
+
+static int64_t score(
+  stusb4500_policy_t const* policy,
+  stusb4500_config_t const* config,
+  stusb4500_candidate_t const* candidate) {
+    int64_t total = 0;
+
+    for (uint8_t i = 0; i < policy->num_terms; i++) {
+        int64_t metric;
+
+        switch (policy->terms[i].criterion) {
+        case STUSB4500_SCORE_POWER:
+            metric = candidate->power_mw;
+            break;
+        case STUSB4500_SCORE_VOLTAGE:
+            metric = candidate->voltage_mv;
+            break;
+        case STUSB4500_SCORE_TARGET_VOLTAGE:
+            metric = (int64_t)candidate->voltage_mv - policy->target_voltage_mv;
+            if (metric < 0) metric = -metric;
+            break;
+        case STUSB4500_SCORE_HEADROOM:
+            metric = (int64_t)candidate->current_ma - config->min_current_ma;
+            break;
+        default:
+            metric = 0;
+            break;
+        }
+
+        total += metric * policy->terms[i].weight;
+    }
+
+    return total;
+}
+
+// Pick the operating point of a PDO within the constraints of the config
+static bool operating_point(
+  stusb4500_config_t const* config,
+  stusb4500_policy_t const* policy,
+  stusb4500_candidate_t* candidate) {
+    stusb4500_src_pdo_t const* pdo = &candidate->pdo;
+    stusb4500_voltage_t lo = pdo->min_voltage_mv;
+    stusb4500_voltage_t hi = pdo->max_voltage_mv;
+
+    if (lo < config->min_voltage_mv) lo = config->min_voltage_mv;
+    if (hi > config->max_voltage_mv) hi = config->max_voltage_mv;
+    if (lo > hi || !hi) return false;
+
+    candidate->voltage_mv = hi;
+    if (policy->target_voltage_mv) {
+        if (policy->target_voltage_mv < lo) {
+            candidate->voltage_mv = lo;
+        } else if (policy->target_voltage_mv < hi) {
+            candidate->voltage_mv = policy->target_voltage_mv;
+        }
+    }
+
+    if (pdo->type == STUSB4500_PDO_BATTERY) {
+        uint32_t current_ma = pdo->max_power_mw * 1000UL / candidate->voltage_mv;
+        candidate->current_ma = (current_ma > UINT16_MAX) ? UINT16_MAX : current_ma;
+    } else {
+        candidate->current_ma = pdo->max_current_ma;
+    }
+    if (candidate->current_ma < config->min_current_ma) return false;
+
+    candidate->power_mw =
+      (stusb4500_power_t)candidate->voltage_mv * candidate->current_ma / 1000UL;
+    return true;
+}
+
+uint8_t stusb4500_pdo_rank(
+  stusb4500_config_t const* config,
+  uint32_t const* src_pdos,
+  uint8_t num_pdos,
+  stusb4500_candidate_t* candidates,
+  uint8_t max_candidates) {
+    if (!config || !src_pdos || !candidates) return 0;
+
+    stusb4500_policy_t const* policy = config->policy ? config->policy : &default_policy;
+    uint8_t num_candidates = 0;
+
+    for (uint8_t i = 0; i < num_pdos && num_candidates < max_candidates; i++) {
+        stusb4500_candidate_t candidate;
+
+        memset(&candidate, 0, sizeof(candidate));
+        if (!stusb4500_pdo_decode(src_pdos[i], &candidate.pdo)) continue;
+        if (!operating_point(config, policy, &candidate)) continue;
+
+        candidate.position = i + 1;
+        candidate.requestable = (candidate.pdo.type == STUSB4500_PDO_FIXED);
+        candidate.score = score(policy, config, &candidate);
+
+        // Insertion sort, candidates with equal scores keep the source's order
+        uint8_t pos = num_candidates;
+        while (pos > 0 && candidates[pos - 1].score < candidate.score) {
+            candidates[pos] = candidates[pos - 1];
+            pos--;
+        }
+        candidates[pos] = candidate;
+        num_candidates++;
+    }
+
+    return num_candidates;
+}
+
+uint8_t stusb4500_pdo_snk_set(
+  stusb4500_config_t const* config,
+  uint32_t const* src_pdos,
+  uint8_t num_pdos,
+  uint32_t* snk_pdos) {
+    stusb4500_candidate_t candidates[STUSB4500_MAX_SRC_PDOS];
+    stusb4500_candidate_t const* opt = NULL;
+    stusb4500_candidate_t const* fallback = NULL;
+    stusb4500_current_t vsafe5v_current_ma;
+
+    if (!snk_pdos) return 0;
+
+    uint8_t const num_candidates =
+      stusb4500_pdo_rank(config, src_pdos, num_pdos, candidates, STUSB4500_MAX_SRC_PDOS);
+
+    for (uint8_t i = 0; i < num_candidates && !opt; i++) {
+        if (candidates[i].requestable) opt = &candidates[i];
+    }
+    if (!opt) return 0;
+
+    // PDO1 must be vSafe5V. Ask for what the source offers at 5V, which is its first PDO
+    vsafe5v_current_ma = config->min_current_ma;
+    if (
+      num_pdos && PDO_TYPE(src_pdos[0]) == PDO_TYPE_FIXED &&
+      FROM_PDO_VOLTAGE(src_pdos[0]) == VSAFE5V_MV)
+        vsafe5v_current_ma = FROM_PDO_CURRENT(src_pdos[0]);
+
+    snk_pdos[0] = TO_PDO_CURRENT(vsafe5v_current_ma) | TO_PDO_VOLTAGE(VSAFE5V_MV);
+    if (opt->voltage_mv == VSAFE5V_MV) {
+        snk_pdos[0] = TO_PDO_CURRENT(opt->current_ma) | TO_PDO_VOLTAGE(opt->voltage_mv);
+        return 1;
+    }
+
+    // Sink capabilities are listed by increasing voltage, so the fallback must lie in between
+    for (uint8_t i = 0; i < num_candidates && !fallback; i++) {
+        if (
+          candidates[i].requestable && candidates[i].voltage_mv > VSAFE5V_MV &&
+          candidates[i].voltage_mv < opt->voltage_mv)
+            fallback = &candidates[i];
+    }
+
+    uint8_t num_snk_pdos = 1;
+    if (fallback) {
+        snk_pdos[num_snk_pdos++] =
+          TO_PDO_CURRENT(fallback->current_ma) | TO_PDO_VOLTAGE(fallback->voltage_mv);
+    }
+    snk_pdos[num_snk_pdos++] = TO_PDO_CURRENT(opt->current_ma) | TO_PDO_VOLTAGE(opt->voltage_mv);
+
+    return num_snk_pdos;
+}
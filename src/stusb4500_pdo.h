@@ -0,0 +1,66 @@
+#pragma once
+
+#include "stusb4500.h"
+
+typedef uint32_t stusb4500_power_t;
+typedef uint32_t stusb4500_pdo_t;
+
+// See USB PD spec Section 7.1.3 and STUSB4500 Section 5.2 Table 16
+#define PDO_TYPE_POS 30UL
+#define PDO_TYPE_MSK (0x03UL << PDO_TYPE_POS)
+#define PDO_TYPE(pdo) (((pdo)&PDO_TYPE_MSK) >> PDO_TYPE_POS)
+#define PDO_TYPE_FIXED 0x00UL
+#define PDO_TYPE_BATTERY 0x01UL
+#define PDO_TYPE_VARIABLE 0x02UL
+#define PDO_TYPE_APDO 0x03UL
+
+// Sink PDO1 voltage, see USB PD spec Section 6.4.1.3
+#define VSAFE5V_MV 5000UL
+
+// Fixed and variable supply current, sink PDO current
+#define PDO_CURRENT_POS 0UL
+#define PDO_CURRENT_MSK (0x03FFUL << PDO_CURRENT_POS)
+#define PDO_CURRENT_RESOLUTION 10UL
+#define FROM_PDO_CURRENT(pdo)                                                                      \
+    ((((pdo)&PDO_CURRENT_MSK) >> PDO_CURRENT_POS) * PDO_CURRENT_RESOLUTION)
+#define TO_PDO_CURRENT(ma) ((((ma) / PDO_CURRENT_RESOLUTION) << PDO_CURRENT_POS) & PDO_CURRENT_MSK)
+
+// Fixed supply voltage, variable supply and battery minimum voltage, sink PDO voltage
+#define PDO_VOLTAGE_POS 10UL
+#define PDO_VOLTAGE_MSK (0x03FFUL << PDO_VOLTAGE_POS)
+#define PDO_VOLTAGE_RESOLUTION 50UL
+#define FROM_PDO_VOLTAGE(pdo)                                                                      \
+    ((((pdo)&PDO_VOLTAGE_MSK) >> PDO_VOLTAGE_POS) * PDO_VOLTAGE_RESOLUTION)
+#define TO_PDO_VOLTAGE(mv) ((((mv) / PDO_VOLTAGE_RESOLUTION) << PDO_VOLTAGE_POS) & PDO_VOLTAGE_MSK)
+
+// Variable supply and battery maximum voltage
+#define PDO_MAX_VOLTAGE_POS 20UL
+#define PDO_MAX_VOLTAGE_MSK (0x03FFUL << PDO_MAX_VOLTAGE_POS)
+#define FROM_PDO_MAX_VOLTAGE(pdo)                                                                  \
+    ((((pdo)&PDO_MAX_VOLTAGE_MSK) >> PDO_MAX_VOLTAGE_POS) * PDO_VOLTAGE_RESOLUTION)
+
+// Battery power
+#define PDO_POWER_POS 0UL
+#define PDO_POWER_MSK (0x03FFUL << PDO_POWER_POS)
+#define PDO_POWER_RESOLUTION 250UL
+#define FROM_PDO_POWER(pdo) ((((pdo)&PDO_POWER_MSK) >> PDO_POWER_POS) * PDO_POWER_RESOLUTION)
+
+// Programmable power supply APDO, see USB PD 3.0 spec Table 6-13
+#define APDO_TYPE_POS 28UL
+#define APDO_TYPE_MSK (0x03UL << APDO_TYPE_POS)
+#define APDO_TYPE(pdo) (((pdo)&APDO_TYPE_MSK) >> APDO_TYPE_POS)
+#define APDO_TYPE_PPS 0x00UL
+#define PPS_MAX_VOLTAGE_POS 17UL
+#define PPS_MAX_VOLTAGE_MSK (0xFFUL << PPS_MAX_VOLTAGE_POS)
+#define PPS_MIN_VOLTAGE_POS 8UL
+#define PPS_MIN_VOLTAGE_MSK (0xFFUL << PPS_MIN_VOLTAGE_POS)
+#define PPS_VOLTAGE_RESOLUTION 100UL
+#define PPS_CURRENT_POS 0UL
+#define PPS_CURRENT_MSK (0x7FUL << PPS_CURRENT_POS)
+#define PPS_CURRENT_RESOLUTION 50UL
+#define FROM_PPS_MAX_VOLTAGE(pdo)                                                                  \
+    ((((pdo)&PPS_MAX_VOLTAGE_MSK) >> PPS_MAX_VOLTAGE_POS) * PPS_VOLTAGE_RESOLUTION)
+#define FROM_PPS_MIN_VOLTAGE(pdo)                                                                  \
+    ((((pdo)&PPS_MIN_VOLTAGE_MSK) >> PPS_MIN_VOLTAGE_POS) * PPS_VOLTAGE_RESOLUTION)
+#define FROM_PPS_CURRENT(pdo)                                                                      \
+    ((((pdo)&PPS_CURRENT_MSK) >> PPS_CURRENT_POS) * PPS_CURRENT_RESOLUTION)
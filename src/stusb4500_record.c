@@ -0,0 +1,153 @@
+#include "stusb4500_record.h"
+
+#include <string.h>
+
+static stusb4500_record_t* active_record = NULL;
+
+static void put_u16(uint8_t* buf, uint16_t value) {
+    buf[0] = (uint8_t)value;
+    buf[1] = (uint8_t)(value >> 8);
+}
+
+static void put_u32(uint8_t* buf, uint32_t value) {
+    put_u16(&buf[0], (uint16_t)value);
+    put_u16(&buf[2], (uint16_t)(value >> 16));
+}
+
+static void emit(stusb4500_record_t* record, void const* buf, size_t len) {
+    if (record->sink_failed) return;
+
+    record->sink_failed = !record->sink(buf, len, record->sink_context);
+}
+
+static void emit_record(
+  stusb4500_record_t* record, stusb4500_record_type_t type, uint32_t timestamp_ms) {
+    uint8_t buf[5];
+
+    buf[0] = type;
+    put_u32(&buf[1], timestamp_ms);
+    emit(record, buf, sizeof(buf));
+    record->records++;
+}
+
+static void emit_access(stusb4500_record_t* record, bool ok, size_t num_msgs) {
+    uint8_t const buf[] = {ok ? 1 : 0, (uint8_t)num_msgs};
+
+    emit(record, buf, sizeof(buf));
+}
+
+static void emit_msg(
+  stusb4500_record_t* record, stusb4500_msg_dir_t dir, uint8_t reg, void const* buf, size_t len) {
+    uint8_t header[4];
+
+    header[0] = dir;
+    header[1] = reg;
+    put_u16(&header[2], (uint16_t)len);
+    emit(record, header, sizeof(header));
+    emit(record, buf, len);
+}
+
+static uint32_t timestamp(stusb4500_record_t const* record) {
+    return record->get_ms ? record->get_ms() : 0;
+}
+
+static bool record_read(uint16_t addr, uint8_t reg, void* buf, size_t len, void* context) {
+    stusb4500_record_t* record = (stusb4500_record_t*)context;
+    stusb4500_t const* dev = record->dev;
+    uint32_t const now = timestamp(record);
+    bool const ok = dev->read(addr, reg, buf, len, dev->context);
+
+    emit_record(record, STUSB4500_RECORD_READ, now);
+    emit_access(record, ok, 1);
+    emit_msg(record, STUSB4500_MSG_READ, reg, buf, len);
+    return ok;
+}
+
+static bool
+  record_write(uint16_t addr, uint8_t reg, void const* buf, size_t len, void* context) {
+    stusb4500_record_t* record = (stusb4500_record_t*)context;
+    stusb4500_t const* dev = record->dev;
+    uint32_t const now = timestamp(record);
+    bool const ok = dev->write(addr, reg, buf, len, dev->context);
+
+    emit_record(record, STUSB4500_RECORD_WRITE, now);
+    emit_access(record, ok, 1);
+    emit_msg(record, STUSB4500_MSG_WRITE, reg, buf, len);
+    return ok;
+}
+
+static bool record_transfer(
+  uint16_t addr, stusb4500_msg_t const* msgs, size_t num_msgs, void* context) {
+    stusb4500_record_t* record = (stusb4500_record_t*)context;
+    stusb4500_t const* dev = record->dev;
+    uint32_t const now = timestamp(record);
+    bool const ok = dev->transfer(addr, msgs, num_msgs, dev->context);
+
+    emit_record(record, STUSB4500_RECORD_TRANSFER, now);
+    emit_access(record, ok, num_msgs);
+    for (size_t i = 0; i < num_msgs; i++) {
+        emit_msg(record, msgs[i].dir, msgs[i].reg, msgs[i].buf, msgs[i].len);
+    }
+    return ok;
+}
+
+static bool record_wait_alert(uint32_t timeout_ms, void* context) {
+    stusb4500_record_t* record = (stusb4500_record_t*)context;
+    stusb4500_t const* dev = record->dev;
+    uint32_t const now = timestamp(record);
+    bool const ok = dev->wait_alert(timeout_ms, dev->context);
+    uint8_t buf[5];
+
+    buf[0] = ok ? 1 : 0;
+    put_u32(&buf[1], timeout_ms);
+    emit_record(record, STUSB4500_RECORD_WAIT_ALERT, now);
+    emit(record, buf, sizeof(buf));
+    return ok;
+}
+
+static void record_delay(uint32_t us, void* context) {
+    stusb4500_t const* dev = ((stusb4500_record_t*)context)->dev;
+
+    dev->delay(us, dev->context);
+}
+
+bool stusb4500_record_start(stusb4500_record_t* record, stusb4500_t* dev) {
+    stusb4500_t const* wrapped;
+    uint8_t header[STUSB4500_RECORD_HEADER_SIZE];
+
+    if (!record || !record->dev || !record->sink || !dev) return false;
+
+    wrapped = record->dev;
+    record->records = 0;
+    record->sink_failed = false;
+
+    memcpy(header, STUSB4500_RECORD_MAGIC, 4);
+    header[4] = STUSB4500_RECORD_VERSION;
+    header[5] = (wrapped->transfer ? STUSB4500_RECORD_HAS_TRANSFER : 0) |
+                (wrapped->wait_alert ? STUSB4500_RECORD_HAS_WAIT_ALERT : 0) |
+                (wrapped->delay ? STUSB4500_RECORD_HAS_DELAY : 0);
+    put_u16(&header[6], wrapped->addr);
+    emit(record, header, sizeof(header));
+
+    // Keep everything else of the wrapped handle, e.g. timeouts and metrics
+    *dev = *wrapped;
+    dev->read = record_read;
+    dev->write = record_write;
+    dev->transfer = wrapped->transfer ? record_transfer : NULL;
+    dev->wait_alert = wrapped->wait_alert ? record_wait_alert : NULL;
+    dev->delay = wrapped->delay ? record_delay : NULL;
+    dev->context = record;
+
+    active_record = record;
+    return !record->sink_failed;
+}
+
+uint32_t stusb4500_record_get_ms(void) {
+    uint32_t now;
+
+    if (!active_record) return 0;
+
+    now = timestamp(active_record);
+    emit_record(active_record, STUSB4500_RECORD_CLOCK, now);
+    return now;
+}
@@ -0,0 +1,15 @@
+#include "stusb4500_regs.h"
+
+#include "stusb4500_bus.h"
+
+bool stusb4500_regs_read(stusb4500_t const* dev, stusb4500_regs_t* regs) {
+    if (!dev || !regs) return false;
+
+    // The FTP registers and the reserved space in between are left out
+    stusb4500_msg_t const msgs[] = {
+      STUSB4500_READ_MSG(STUSB4500_REG_BCD_TYPEC_REV_LOW, regs->status, sizeof(regs->status)),
+      STUSB4500_READ_MSG(STUSB4500_REG_DPM_PDO_NUMB, regs->dpm, sizeof(regs->dpm)),
+    };
+
+    return stusb4500_transfer(dev, msgs, STUSB4500_NUM_MSGS(msgs));
+}
@@ -0,0 +1,181 @@
+#include "stusb4500_replay.h"
+
+#include <string.h>
+
+static stusb4500_replay_t* active_replay = NULL;
+
+static bool get_bytes(stusb4500_replay_t* replay, void* buf, size_t len) {
+    if (len && fread(buf, 1, len, replay->file) != len) {
+        replay->divergence = STUSB4500_REPLAY_CORRUPT;
+        return false;
+    }
+
+    return true;
+}
+
+static uint16_t get_u16(uint8_t const* buf) {
+    return (uint16_t)(buf[0] | (buf[1] << 8));
+}
+
+static uint32_t get_u32(uint8_t const* buf) {
+    return get_u16(&buf[0]) | ((uint32_t)get_u16(&buf[2]) << 16);
+}
+
+static bool diverge(stusb4500_replay_t* replay, stusb4500_divergence_t divergence) {
+    if (replay->divergence == STUSB4500_REPLAY_OK) replay->divergence = divergence;
+    return false;
+}
+
+// Consume the next record, which must be of the given type
+static bool next_record(stusb4500_replay_t* replay, stusb4500_record_type_t type) {
+    uint8_t buf[5];
+    int c;
+
+    if (replay->divergence != STUSB4500_REPLAY_OK) return false;
+
+    replay->diverged_at = replay->records;
+
+    c = fgetc(replay->file);
+    if (c == EOF) return diverge(replay, STUSB4500_REPLAY_END);
+    buf[0] = (uint8_t)c;
+    if (!get_bytes(replay, &buf[1], sizeof(buf) - 1)) return false;
+
+    if (buf[0] != type) return diverge(replay, STUSB4500_REPLAY_TYPE);
+
+    replay->now_ms = get_u32(&buf[1]);
+    replay->records++;
+    return true;
+}
+
+// Replay a bus record against the requested messages
+static bool replay_access(
+  stusb4500_replay_t* replay,
+  stusb4500_record_type_t type,
+  stusb4500_msg_t const* msgs,
+  size_t num_msgs) {
+    uint8_t access[2];
+    uint8_t header[4];
+    uint8_t written[256];
+
+    if (!next_record(replay, type)) return false;
+    if (!get_bytes(replay, access, sizeof(access))) return false;
+    if (access[1] != num_msgs) return diverge(replay, STUSB4500_REPLAY_MESSAGE);
+
+    for (size_t i = 0; i < num_msgs; i++) {
+        stusb4500_msg_t const* msg = &msgs[i];
+        uint16_t len;
+
+        if (!get_bytes(replay, header, sizeof(header))) return false;
+
+        len = get_u16(&header[2]);
+        replay->expected_reg = header[1];
+        replay->actual_reg = msg->reg;
+        if (header[0] != msg->dir || header[1] != msg->reg || len != msg->len)
+            return diverge(replay, STUSB4500_REPLAY_MESSAGE);
+
+        if (msg->dir == STUSB4500_MSG_READ) {
+            if (!get_bytes(replay, msg->buf, len)) return false;
+        } else {
+            if (len > sizeof(written)) return diverge(replay, STUSB4500_REPLAY_CORRUPT);
+            if (!get_bytes(replay, written, len)) return false;
+            if (memcmp(written, msg->buf, len) != 0)
+                return diverge(replay, STUSB4500_REPLAY_PAYLOAD);
+        }
+    }
+
+    return access[0] != 0;
+}
+
+static bool replay_read(uint16_t addr, uint8_t reg, void* buf, size_t len, void* context) {
+    stusb4500_msg_t const msg = {reg, STUSB4500_MSG_READ, buf, len};
+
+    (void)addr;
+    return replay_access((stusb4500_replay_t*)context, STUSB4500_RECORD_READ, &msg, 1);
+}
+
+static bool
+  replay_write(uint16_t addr, uint8_t reg, void const* buf, size_t len, void* context) {
+    stusb4500_msg_t const msg = {reg, STUSB4500_MSG_WRITE, (void*)buf, len};
+
+    (void)addr;
+    return replay_access((stusb4500_replay_t*)context, STUSB4500_RECORD_WRITE, &msg, 1);
+}
+
+static bool replay_transfer(
+  uint16_t addr, stusb4500_msg_t const* msgs, size_t num_msgs, void* context) {
+    (void)addr;
+    return replay_access((stusb4500_replay_t*)context, STUSB4500_RECORD_TRANSFER, msgs, num_msgs);
+}
+
+// Returns whether ALERT was asserted in the recording, so timeouts take the same path
+static bool replay_wait_alert(uint32_t timeout_ms, void* context) {
+    stusb4500_replay_t* replay = (stusb4500_replay_t*)context;
+    uint8_t buf[5];
+
+    if (!next_record(replay, STUSB4500_RECORD_WAIT_ALERT)) return false;
+    if (!get_bytes(replay, buf, sizeof(buf))) return false;
+    if (get_u32(&buf[1]) != timeout_ms) return diverge(replay, STUSB4500_REPLAY_MESSAGE);
+
+    return buf[0] != 0;
+}
+
+// Keeps the backoff accounting of the recording, at full speed
+static void replay_delay(uint32_t us, void* context) {
+    (void)us;
+    (void)context;
+}
+
+bool stusb4500_replay_open(stusb4500_replay_t* replay, FILE* file, stusb4500_t* dev) {
+    uint8_t header[STUSB4500_RECORD_HEADER_SIZE];
+
+    if (!replay || !file || !dev) return false;
+
+    replay->file = file;
+    replay->divergence = STUSB4500_REPLAY_OK;
+    replay->diverged_at = 0;
+    replay->expected_reg = 0;
+    replay->actual_reg = 0;
+    replay->records = 0;
+    replay->now_ms = 0;
+
+    if (
+      !get_bytes(replay, header, sizeof(header)) ||
+      memcmp(header, STUSB4500_RECORD_MAGIC, 4) != 0 ||
+      header[4] != STUSB4500_RECORD_VERSION) {
+        replay->divergence = STUSB4500_REPLAY_CORRUPT;
+        return false;
+    }
+
+    memset(dev, 0, sizeof(*dev));
+    dev->addr = get_u16(&header[6]);
+    dev->read = replay_read;
+    dev->write = replay_write;
+    dev->transfer = (header[5] & STUSB4500_RECORD_HAS_TRANSFER) ? replay_transfer : NULL;
+    dev->wait_alert = (header[5] & STUSB4500_RECORD_HAS_WAIT_ALERT) ? replay_wait_alert : NULL;
+    dev->delay = (header[5] & STUSB4500_RECORD_HAS_DELAY) ? replay_delay : NULL;
+    dev->context = replay;
+
+    active_replay = replay;
+    return true;
+}
+
+uint32_t stusb4500_replay_get_ms(void) {
+    if (!active_replay || !next_record(active_replay, STUSB4500_RECORD_CLOCK)) return 0;
+
+    return active_replay->now_ms;
+}
+
+bool stusb4500_replay_finish(stusb4500_replay_t* replay) {
+    if (!replay) return false;
+
+    if (replay->divergence == STUSB4500_REPLAY_OK && fgetc(replay->file) != EOF) {
+        replay->diverged_at = replay->records;
+        replay->divergence = STUSB4500_REPLAY_UNCONSUMED;
+    }
+
+    return replay->divergence == STUSB4500_REPLAY_OK;
+}
+
+bool stusb4500_record_file_sink(void const* buf, size_t len, void* context) {
+    return fwrite(buf, 1, len, (FILE*)context) == len;
+}
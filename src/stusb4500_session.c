@@ -0,0 +1,48 @@
+#include "stusb4500_session.h"
+
+static void lock_bus(void* context) {
+    stusb4500_session_bus_t* bus = (stusb4500_session_bus_t*)context;
+
+    if (pthread_mutex_trylock(&bus->mutex) == 0) return;
+
+    pthread_mutex_lock(&bus->mutex);
+    // Counted under the lock
+    bus->contentions++;
+}
+
+static void unlock_bus(void* context) {
+    stusb4500_session_bus_t* bus = (stusb4500_session_bus_t*)context;
+
+    pthread_mutex_unlock(&bus->mutex);
+}
+
+bool stusb4500_session_bus_init(stusb4500_session_bus_t* bus) {
+    pthread_mutexattr_t attr;
+    bool ok;
+
+    if (!bus) return false;
+
+    bus->contentions = 0;
+
+    // Sequences nest, e.g. an FTP command holds the bus around its own transactions
+    if (pthread_mutexattr_init(&attr) != 0) return false;
+    ok = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE) == 0 &&
+         pthread_mutex_init(&bus->mutex, &attr) == 0;
+    pthread_mutexattr_destroy(&attr);
+
+    return ok;
+}
+
+void stusb4500_session_bus_destroy(stusb4500_session_bus_t* bus) {
+    if (!bus) return;
+
+    pthread_mutex_destroy(&bus->mutex);
+}
+
+void stusb4500_session_attach(stusb4500_session_bus_t* bus, stusb4500_t* dev) {
+    if (!bus || !dev) return;
+
+    dev->lock = lock_bus;
+    dev->unlock = unlock_bus;
+    dev->lock_context = bus;
+}
@@ -0,0 +1,548 @@
+#include "stusb4500_sim.h"
+
+#include <string.h>
+
+// Modeled registers
+#define SIM_ALERT_STATUS_1 0x0BUL
+#define SIM_ALERT_STATUS_1_MASK 0x0CUL
+#define SIM_PORT_STATUS_0 0x0DUL
+#define SIM_PORT_STATUS_1 0x0EUL
+#define SIM_PRT_STATUS 0x16UL
+#define SIM_CMD_CTRL 0x1AUL
+#define SIM_PE_FSM 0x29UL
+#define SIM_WHO_AM_I 0x2FUL
+#define SIM_RX_BYTE_CNT 0x30UL
+#define SIM_RX_HEADER 0x31UL
+#define SIM_RX_DATA_OBJ 0x33UL
+#define SIM_RX_DATA_OBJ_END 0x4FUL
+#define SIM_TX_HEADER 0x51UL
+#define SIM_RW_BUFFER 0x53UL
+#define SIM_DPM_PDO_NUMB 0x70UL
+#define SIM_DPM_SNK_PDO1 0x85UL
+#define SIM_RDO_STATUS 0x91UL
+#define SIM_FTP_PASSWORD_REG 0x95UL
+#define SIM_FTP_CTRL_0 0x96UL
+#define SIM_FTP_CTRL_1 0x97UL
+
+#define SIM_DEVICE_ID 0x25UL
+#define SIM_ATTACH 0x01UL
+#define SIM_PRT_MESSAGE_RECEIVED 0x04UL
+#define SIM_ALERT_PRT_STATUS 0x02UL
+#define SIM_ALERT_PORT_STATUS 0x40UL
+#define SIM_PD_CMD 0x26UL
+#define SIM_PD_SOFT_RESET 0x000DUL
+#define SIM_FTP_PASSWORD 0x47UL
+#define SIM_FTP_PWR 0x80UL
+#define SIM_FTP_RST_N 0x40UL
+#define SIM_FTP_REQ 0x10UL
+
+// Policy engine states reported in PE_FSM
+#define SIM_PE_INIT 0x00UL
+#define SIM_PE_SEND_SOFT_RESET 0x03UL
+#define SIM_PE_SNK_WAIT_FOR_CAPABILITIES 0x14UL
+#define SIM_PE_SNK_SELECT_CAPABILITY 0x16UL
+#define SIM_PE_SNK_TRANSITION_SINK 0x17UL
+#define SIM_PE_SNK_READY 0x18UL
+
+// PD message types
+#define SIM_MSG_SRC_CAPABILITIES 0x01UL
+#define SIM_MSG_ACCEPT 0x03UL
+#define SIM_MSG_PS_RDY 0x06UL
+
+// Source behavior
+enum {
+    PD_IDLE,
+    PD_SOFT_RESET_ACCEPT,
+    PD_SRC_CAPABILITIES,
+    PD_ACCEPT,
+    PD_PS_RDY,
+};
+
+#define SIM_NUM_SECTORS 5UL
+#define SIM_SECTOR_SIZE 8UL
+
+#define PDO_CURRENT_MA(pdo) (((pdo)&0x03FFUL) * 10UL)
+#define PDO_VOLTAGE_MV(pdo) ((((pdo) >> 10) & 0x03FFUL) * 50UL)
+#define PDO_IS_FIXED(pdo) ((((pdo) >> 30) & 0x03UL) == 0UL)
+
+// Factory NVM content of the STUSB4500
+static uint8_t const default_nvm[STUSB4500_SIM_NVM_SIZE] = {
+  0x00, 0x00, 0xB0, 0xAA, 0x00, 0x45, 0x00, 0x00, // sector 0
+  0x10, 0x40, 0x9C, 0x1C, 0xFF, 0x01, 0x3C, 0xDF, // sector 1
+  0x02, 0x40, 0x0F, 0x00, 0x32, 0x00, 0xFC, 0xF1, // sector 2
+  0x00, 0x19, 0x56, 0xAF, 0xF5, 0x35, 0x5F, 0x00, // sector 3
+  0x00, 0x4B, 0x90, 0x21, 0x43, 0x00, 0x40, 0xFB, // sector 4
+};
+
+static stusb4500_sim_t* active_sim;
+
+static uint32_t get_u32(uint8_t const* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+static void put_u32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static void receive_message(stusb4500_sim_t* sim, uint8_t type, uint32_t const* objs, uint8_t n) {
+    // Spec revision 2.0, source/DFP roles
+    uint16_t header = (uint16_t)(((uint16_t)n << 12) | ((sim->msg_id & 0x07U) << 9) |
+                                 (1U << 8) | (1U << 6) | (1U << 5) | type);
+    sim->msg_id++;
+
+    sim->regs[SIM_RX_BYTE_CNT] = (uint8_t)(n * sizeof(uint32_t));
+    sim->regs[SIM_RX_HEADER] = (uint8_t)header;
+    sim->regs[SIM_RX_HEADER + 1] = (uint8_t)(header >> 8);
+    for (uint8_t i = 0; i < n; i++) {
+        put_u32(&sim->regs[SIM_RX_DATA_OBJ + i * sizeof(uint32_t)], objs[i]);
+    }
+
+    sim->regs[SIM_PRT_STATUS] |= SIM_PRT_MESSAGE_RECEIVED;
+    sim->regs[SIM_ALERT_STATUS_1] |= SIM_ALERT_PRT_STATUS;
+}
+
+// Match the sink PDOs against the source capabilities like the STUSB4500 policy engine does:
+// the highest numbered sink PDO with a matching source voltage wins, 5V is the fallback
+static void evaluate_capabilities(stusb4500_sim_t* sim) {
+    uint8_t num_snk = sim->regs[SIM_DPM_PDO_NUMB] & 0x07U;
+    uint32_t rdo;
+
+    if (num_snk < 1) num_snk = 1;
+    if (num_snk > 3) num_snk = 3;
+
+    for (int s = num_snk - 1; s >= 0; s--) {
+        uint32_t snk = get_u32(&sim->regs[SIM_DPM_SNK_PDO1 + s * sizeof(uint32_t)]);
+
+        for (uint8_t i = 0; i < sim->config.num_src_pdos; i++) {
+            uint32_t src = sim->config.src_pdos[i];
+            if (
+              !PDO_IS_FIXED(src) || PDO_VOLTAGE_MV(src) != PDO_VOLTAGE_MV(snk) ||
+              PDO_CURRENT_MA(src) < PDO_CURRENT_MA(snk))
+                continue;
+
+            rdo = ((uint32_t)(i + 1) << 28) | ((snk & 0x03FFUL) << 10) | (snk & 0x03FFUL);
+            put_u32(&sim->regs[SIM_RDO_STATUS], rdo);
+            return;
+        }
+    }
+
+    // Capability mismatch, request vSafe5V at the source's current
+    rdo = (1UL << 28) | (1UL << 26) | ((sim->config.src_pdos[0] & 0x03FFUL) << 10) |
+          (sim->config.src_pdos[0] & 0x03FFUL);
+    put_u32(&sim->regs[SIM_RDO_STATUS], rdo);
+}
+
+static void schedule(stusb4500_sim_t* sim, uint8_t phase, uint64_t at_us) {
+    sim->pd_phase = phase;
+    sim->pd_event_us = at_us;
+}
+
+static void run_pd_event(stusb4500_sim_t* sim) {
+    uint64_t const t = sim->pd_event_us;
+
+    switch (sim->pd_phase) {
+    case PD_SOFT_RESET_ACCEPT:
+        receive_message(sim, SIM_MSG_ACCEPT, NULL, 0);
+        sim->regs[SIM_PE_FSM] = SIM_PE_SNK_WAIT_FOR_CAPABILITIES;
+        schedule(sim, PD_SRC_CAPABILITIES, t + sim->config.caps_delay_us);
+        break;
+    case PD_SRC_CAPABILITIES:
+        receive_message(
+          sim, SIM_MSG_SRC_CAPABILITIES, sim->config.src_pdos, sim->config.num_src_pdos);
+        sim->caps_clobbered = false;
+        sim->regs[SIM_PE_FSM] = SIM_PE_SNK_SELECT_CAPABILITY;
+        evaluate_capabilities(sim);
+        schedule(sim, PD_ACCEPT, t + sim->config.accept_delay_us);
+        break;
+    case PD_ACCEPT:
+        receive_message(sim, SIM_MSG_ACCEPT, NULL, 0);
+        // The RX buffer is not cleared, the Accept only partially overwrites the data objects
+        memset(&sim->regs[SIM_RX_DATA_OBJ], 0x00, sim->config.accept_overwrite_bytes);
+        sim->caps_clobbered = sim->config.accept_overwrite_bytes > 0;
+        sim->regs[SIM_PE_FSM] = SIM_PE_SNK_TRANSITION_SINK;
+        schedule(sim, PD_PS_RDY, t + sim->config.ready_delay_us);
+        break;
+    case PD_PS_RDY:
+        receive_message(sim, SIM_MSG_PS_RDY, NULL, 0);
+        sim->regs[SIM_PE_FSM] = SIM_PE_SNK_READY;
+        schedule(sim, PD_IDLE, 0);
+        break;
+    default:
+        break;
+    }
+}
+
+static void run_ftp_command(stusb4500_sim_t* sim) {
+    uint8_t* sector = &sim->nvm[sim->ftp_sector * SIM_SECTOR_SIZE];
+
+    switch (sim->ftp_opcode) {
+    case 0x00: // Read sector
+        memcpy(&sim->regs[SIM_RW_BUFFER], sector, SIM_SECTOR_SIZE);
+        break;
+    case 0x01: // Write PL
+        memcpy(sim->ftp_pl, &sim->regs[SIM_RW_BUFFER], SIM_SECTOR_SIZE);
+        break;
+    case 0x02: // Write SER
+        sim->ftp_ser = (uint8_t)(sim->regs[SIM_FTP_CTRL_1] >> 3);
+        break;
+    case 0x03: // Read PL
+        memcpy(&sim->regs[SIM_RW_BUFFER], sim->ftp_pl, SIM_SECTOR_SIZE);
+        break;
+    case 0x04: // Read SER
+        sim->regs[SIM_RW_BUFFER] = (uint8_t)(sim->ftp_ser << 3);
+        break;
+    case 0x05: // Erase sectors masked by SER
+        for (uint8_t s = 0; s < SIM_NUM_SECTORS; s++) {
+            if (!(sim->ftp_ser & (1U << s))) continue;
+            memset(&sim->nvm[s * SIM_SECTOR_SIZE], 0x00, SIM_SECTOR_SIZE);
+            sim->stats.sector_erases[s]++;
+        }
+        break;
+    case 0x06: // Program sector, can only set bits of an erased sector
+        for (uint8_t i = 0; i < SIM_SECTOR_SIZE; i++) {
+            sector[i] |= sim->ftp_pl[i];
+        }
+        sim->stats.sector_programs[sim->ftp_sector]++;
+        break;
+    default: // Soft program
+        break;
+    }
+
+    sim->ftp_busy = false;
+    sim->regs[SIM_FTP_CTRL_0] &= (uint8_t)~SIM_FTP_REQ;
+}
+
+static void advance_local_us(stusb4500_sim_t* sim, uint64_t us) {
+    sim->now_us += us;
+
+    while (sim->pd_phase != PD_IDLE && sim->pd_event_us <= sim->now_us) {
+        run_pd_event(sim);
+    }
+
+    if (sim->ftp_busy && sim->ftp_done_us <= sim->now_us) run_ftp_command(sim);
+}
+
+void stusb4500_sim_advance_us(stusb4500_sim_t* sim, uint64_t us) {
+    stusb4500_sim_t* peer = sim;
+
+    // Devices sharing a bus share the time base
+    do {
+        advance_local_us(peer, us);
+        peer = peer->next_on_bus;
+    } while (peer && peer != sim);
+}
+
+void stusb4500_sim_share_bus(stusb4500_sim_t* const* sims, size_t num_sims) {
+    for (size_t i = 0; i < num_sims; i++) {
+        sims[i]->now_us = sims[0]->now_us;
+        sims[i]->next_on_bus = sims[(i + 1) % num_sims];
+    }
+}
+
+// Bus time in bits: 9 clocks per byte, plus start, repeated start and stop conditions
+#define BYTE_BITS 9ULL
+#define CONDITION_BITS 1ULL
+
+static void bus_time(stusb4500_sim_t* sim, uint64_t bits) {
+    uint64_t us;
+
+    // Accumulate bits rather than microseconds so byte-wise accounting does not round up
+    sim->bus_bits += bits;
+    us = (sim->bus_bits * 1000000ULL + sim->config.bus_clock_hz - 1) / sim->config.bus_clock_hz;
+
+    stusb4500_sim_advance_us(sim, us - sim->stats.bus_time_us);
+    sim->stats.bus_time_us = us;
+}
+
+static void begin_transaction(stusb4500_sim_t* sim) {
+    sim->stats.transactions++;
+    stusb4500_sim_advance_us(sim, sim->config.transaction_overhead_us);
+}
+
+static void start_ftp_command(stusb4500_sim_t* sim, uint8_t ctrl0) {
+    uint32_t us;
+
+    if (sim->regs[SIM_FTP_PASSWORD_REG] != SIM_FTP_PASSWORD) return;
+
+    // Clearing RST_N resets the controller and aborts a pending command
+    if (!(ctrl0 & SIM_FTP_RST_N)) {
+        sim->ftp_busy = false;
+        return;
+    }
+
+    if (!(ctrl0 & SIM_FTP_PWR) || !(ctrl0 & SIM_FTP_REQ) || sim->ftp_busy) return;
+
+    sim->ftp_opcode = sim->regs[SIM_FTP_CTRL_1] & 0x07U;
+    sim->ftp_sector = ctrl0 & 0x07U;
+    if (sim->ftp_sector >= SIM_NUM_SECTORS) sim->ftp_sector = 0;
+
+    switch (sim->ftp_opcode) {
+    case 0x05:
+        us = sim->config.ftp_erase_us;
+        break;
+    case 0x06:
+    case 0x07:
+        us = sim->config.ftp_program_us;
+        break;
+    default:
+        us = sim->config.ftp_op_us;
+        break;
+    }
+
+    sim->ftp_busy = true;
+    sim->ftp_done_us = sim->now_us + us;
+    if (us == 0) run_ftp_command(sim);
+}
+
+static void send_soft_reset(stusb4500_sim_t* sim) {
+    sim->stats.soft_resets++;
+    if (!(sim->regs[SIM_PORT_STATUS_1] & SIM_ATTACH)) return;
+
+    sim->regs[SIM_PE_FSM] = SIM_PE_SEND_SOFT_RESET;
+    schedule(sim, PD_SOFT_RESET_ACCEPT, sim->now_us + sim->config.soft_reset_accept_us);
+}
+
+static bool is_read_only(uint8_t reg) {
+    return reg == SIM_ALERT_STATUS_1 || (reg >= SIM_PORT_STATUS_0 && reg <= SIM_PRT_STATUS) ||
+           reg == SIM_PE_FSM || reg == SIM_WHO_AM_I ||
+           (reg >= SIM_RX_BYTE_CNT && reg < SIM_RX_DATA_OBJ_END) ||
+           (reg >= SIM_RDO_STATUS && reg < SIM_FTP_PASSWORD_REG);
+}
+
+static bool is_clear_on_read(uint8_t reg) {
+    return reg == SIM_ALERT_STATUS_1 || reg == SIM_PORT_STATUS_0 || reg == SIM_PRT_STATUS;
+}
+
+// Registers are sampled as each byte is clocked out, so events may occur within a burst
+static void read_regs(stusb4500_sim_t* sim, uint8_t reg, uint8_t* p, size_t len) {
+    bool late = false;
+
+    // Start, address, register, repeated start and address again
+    bus_time(sim, 3 * BYTE_BITS + 2 * CONDITION_BITS);
+    sim->stats.reads++;
+    sim->stats.bytes_read += (uint32_t)len;
+
+    for (size_t i = 0; i < len; i++) {
+        uint8_t r = (uint8_t)(reg + i);
+
+        bus_time(sim, BYTE_BITS);
+        p[i] = sim->regs[r];
+        if (is_clear_on_read(r)) sim->regs[r] = 0x00;
+
+        if (
+          sim->caps_clobbered && r >= SIM_RX_DATA_OBJ &&
+          r < SIM_RX_DATA_OBJ + sim->config.accept_overwrite_bytes)
+            late = true;
+    }
+
+    if (late) sim->stats.late_caps_reads++;
+}
+
+static void write_regs(stusb4500_sim_t* sim, uint8_t reg, uint8_t const* p, size_t len) {
+    // Start, address and register
+    bus_time(sim, 2 * BYTE_BITS + CONDITION_BITS);
+    sim->stats.writes++;
+    sim->stats.bytes_written += (uint32_t)len;
+
+    for (size_t i = 0; i < len; i++) {
+        uint8_t r = (uint8_t)(reg + i);
+
+        bus_time(sim, BYTE_BITS);
+        if (is_read_only(r)) continue;
+
+        if (r == SIM_FTP_CTRL_0) {
+            // REQ is owned by the controller while a command executes
+            sim->regs[r] = sim->ftp_busy ? (uint8_t)(p[i] | SIM_FTP_REQ) : p[i];
+            start_ftp_command(sim, p[i]);
+            if (!sim->ftp_busy) sim->regs[r] &= (uint8_t)~SIM_FTP_REQ;
+            continue;
+        }
+
+        sim->regs[r] = p[i];
+
+        if (
+          r == SIM_CMD_CTRL && p[i] == SIM_PD_CMD &&
+          (sim->regs[SIM_TX_HEADER] | (sim->regs[SIM_TX_HEADER + 1] << 8)) == SIM_PD_SOFT_RESET)
+            send_soft_reset(sim);
+    }
+}
+
+static bool is_valid_access(stusb4500_sim_t const* sim, uint8_t reg, void const* buf, size_t len) {
+    return sim && buf && reg + len <= sizeof(sim->regs);
+}
+
+bool stusb4500_sim_read(uint16_t addr, uint8_t reg, void* buf, size_t len, void* context) {
+    stusb4500_sim_t* sim = (stusb4500_sim_t*)context;
+    (void)addr;
+
+    if (!is_valid_access(sim, reg, buf, len)) return false;
+
+    begin_transaction(sim);
+    read_regs(sim, reg, (uint8_t*)buf, len);
+    bus_time(sim, CONDITION_BITS);
+
+    return true;
+}
+
+bool stusb4500_sim_write(uint16_t addr, uint8_t reg, void const* buf, size_t len, void* context) {
+    stusb4500_sim_t* sim = (stusb4500_sim_t*)context;
+    (void)addr;
+
+    if (!is_valid_access(sim, reg, buf, len)) return false;
+
+    begin_transaction(sim);
+    write_regs(sim, reg, (uint8_t const*)buf, len);
+    bus_time(sim, CONDITION_BITS);
+
+    return true;
+}
+
+bool stusb4500_sim_transfer(
+  uint16_t addr, stusb4500_msg_t const* msgs, size_t num_msgs, void* context) {
+    stusb4500_sim_t* sim = (stusb4500_sim_t*)context;
+    (void)addr;
+
+    if (!msgs) return false;
+    for (size_t i = 0; i < num_msgs; i++) {
+        if (!is_valid_access(sim, msgs[i].reg, msgs[i].buf, msgs[i].len)) return false;
+    }
+
+    // Messages are separated by repeated starts, the device state may change in between
+    begin_transaction(sim);
+    for (size_t i = 0; i < num_msgs; i++) {
+        stusb4500_msg_t const* msg = &msgs[i];
+
+        if (msg->dir == STUSB4500_MSG_READ) {
+            read_regs(sim, msg->reg, (uint8_t*)msg->buf, msg->len);
+        } else {
+            write_regs(sim, msg->reg, (uint8_t const*)msg->buf, msg->len);
+        }
+    }
+    bus_time(sim, CONDITION_BITS);
+
+    return true;
+}
+
+void stusb4500_sim_set_attached(stusb4500_sim_t* sim, bool attached) {
+    bool was_attached = sim->regs[SIM_PORT_STATUS_1] & SIM_ATTACH;
+    if (attached == was_attached) return;
+
+    sim->regs[SIM_PORT_STATUS_0] |= SIM_ATTACH;
+    sim->regs[SIM_ALERT_STATUS_1] |= SIM_ALERT_PORT_STATUS;
+
+    if (attached) {
+        sim->regs[SIM_PORT_STATUS_1] |= SIM_ATTACH;
+        sim->regs[SIM_PE_FSM] = SIM_PE_SNK_WAIT_FOR_CAPABILITIES;
+        schedule(sim, PD_SRC_CAPABILITIES, sim->now_us + sim->config.attach_settle_us);
+    } else {
+        sim->regs[SIM_PORT_STATUS_1] &= (uint8_t)~SIM_ATTACH;
+        sim->regs[SIM_PE_FSM] = SIM_PE_INIT;
+        memset(&sim->regs[SIM_RDO_STATUS], 0x00, sizeof(uint32_t));
+        schedule(sim, PD_IDLE, 0);
+    }
+}
+
+void stusb4500_sim_default_config(stusb4500_sim_config_t* config) {
+    memset(config, 0, sizeof(*config));
+
+    config->bus_clock_hz = 100000UL;
+    config->attach_settle_us = 150000UL;
+    config->soft_reset_accept_us = 1000UL;
+    config->caps_delay_us = 15000UL;
+    config->accept_delay_us = 2500UL;
+    config->ready_delay_us = 20000UL;
+    config->accept_overwrite_bytes = 4;
+
+    config->ftp_op_us = 50UL;
+    config->ftp_erase_us = 5000UL;
+    config->ftp_program_us = 2000UL;
+
+    config->src_pdos[0] = STUSB4500_SIM_FIXED_PDO(5000, 3000);
+    config->src_pdos[1] = STUSB4500_SIM_FIXED_PDO(9000, 3000);
+    config->src_pdos[2] = STUSB4500_SIM_FIXED_PDO(15000, 3000);
+    config->src_pdos[3] = STUSB4500_SIM_FIXED_PDO(20000, 2250);
+    config->num_src_pdos = 4;
+
+    config->attached = true;
+}
+
+void stusb4500_sim_init(stusb4500_sim_t* sim, stusb4500_sim_config_t const* config) {
+    memset(sim, 0, sizeof(*sim));
+    sim->config = *config;
+    if (!sim->config.bus_clock_hz) sim->config.bus_clock_hz = 100000UL;
+    if (sim->config.num_src_pdos > STUSB4500_SIM_MAX_SRC_PDOS)
+        sim->config.num_src_pdos = STUSB4500_SIM_MAX_SRC_PDOS;
+    if (sim->config.accept_overwrite_bytes > SIM_RX_DATA_OBJ_END - SIM_RX_DATA_OBJ)
+        sim->config.accept_overwrite_bytes = SIM_RX_DATA_OBJ_END - SIM_RX_DATA_OBJ;
+
+    memcpy(sim->nvm, default_nvm, sizeof(sim->nvm));
+
+    sim->regs[SIM_WHO_AM_I] = SIM_DEVICE_ID;
+    sim->regs[SIM_ALERT_STATUS_1_MASK] = 0xFF;
+    sim->regs[SIM_FTP_CTRL_0] = SIM_FTP_RST_N;
+    sim->regs[SIM_DPM_PDO_NUMB] = 3;
+    put_u32(&sim->regs[SIM_DPM_SNK_PDO1], STUSB4500_SIM_FIXED_PDO(5000, 1500));
+    put_u32(&sim->regs[SIM_DPM_SNK_PDO1 + 4], STUSB4500_SIM_FIXED_PDO(15000, 1500));
+    put_u32(&sim->regs[SIM_DPM_SNK_PDO1 + 8], STUSB4500_SIM_FIXED_PDO(20000, 1000));
+
+    // Powered up with a cable attached, an explicit contract is already in place
+    if (sim->config.attached) {
+        sim->regs[SIM_PORT_STATUS_1] = SIM_ATTACH;
+        if (sim->config.num_src_pdos) {
+            sim->regs[SIM_PE_FSM] = SIM_PE_SNK_READY;
+            evaluate_capabilities(sim);
+        }
+    }
+
+    active_sim = sim;
+}
+
+void stusb4500_sim_bind(stusb4500_sim_t* sim, stusb4500_t* dev) {
+    memset(dev, 0, sizeof(*dev));
+    dev->addr = 0x28;
+    dev->write = stusb4500_sim_write;
+    dev->read = stusb4500_sim_read;
+    dev->context = sim;
+    dev->transfer = stusb4500_sim_transfer;
+    dev->delay = stusb4500_sim_delay;
+}
+
+void stusb4500_sim_delay(uint32_t us, void* context) {
+    stusb4500_sim_t* sim = (stusb4500_sim_t*)context;
+
+    sim->stats.delays++;
+    sim->stats.delay_time_us += us;
+    stusb4500_sim_advance_us(sim, us);
+}
+
+bool stusb4500_sim_alert_asserted(stusb4500_sim_t const* sim) {
+    return (sim->regs[SIM_ALERT_STATUS_1] & ~sim->regs[SIM_ALERT_STATUS_1_MASK]) != 0;
+}
+
+bool stusb4500_sim_wait_alert(uint32_t timeout_ms, void* context) {
+    stusb4500_sim_t* sim = (stusb4500_sim_t*)context;
+    uint64_t const deadline = sim->now_us + (uint64_t)timeout_ms * 1000ULL;
+
+    sim->stats.alert_waits++;
+
+    // Skip ahead from event to event, the bus is idle while the host sleeps
+    while (!stusb4500_sim_alert_asserted(sim)) {
+        uint64_t next = deadline;
+        if (sim->pd_phase != PD_IDLE && sim->pd_event_us < next) next = sim->pd_event_us;
+        if (sim->ftp_busy && sim->ftp_done_us < next) next = sim->ftp_done_us;
+        if (next <= sim->now_us && next == deadline) break;
+
+        stusb4500_sim_advance_us(sim, next - sim->now_us);
+        if (sim->now_us >= deadline) break;
+    }
+
+    return stusb4500_sim_alert_asserted(sim);
+}
+
+uint32_t stusb4500_sim_get_ms(void) {
+    return active_sim ? (uint32_t)(active_sim->now_us / 1000ULL) : 0;
+}
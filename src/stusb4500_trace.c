@@ -0,0 +1,48 @@
+#include "stusb4500_trace.h"
+
+#ifdef __GNUC__
+#define LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else // __GNUC__
+// Single core targets, volatile accesses keep the index and record accesses in order
+#define LOAD_ACQUIRE(p) (*(uint32_t volatile*)(p))
+#define STORE_RELEASE(p, v) (*(uint32_t volatile*)(p) = (v))
+#endif // __GNUC__
+
+bool stusb4500_trace_init(
+  stusb4500_trace_t* trace, stusb4500_trace_record_t* records, uint32_t capacity) {
+    if (!trace || !records || !capacity || (capacity & (capacity - 1))) return false;
+
+    trace->records = records;
+    trace->capacity = capacity;
+    trace->head = 0;
+    trace->dropped = 0;
+    trace->tail = 0;
+    return true;
+}
+
+bool stusb4500_trace_push(stusb4500_trace_t* trace, stusb4500_trace_record_t const* record) {
+    uint32_t const head = trace->head;
+    uint32_t const tail = LOAD_ACQUIRE(&trace->tail);
+
+    // Never wait for the consumer
+    if (head - tail >= trace->capacity) {
+        trace->dropped++;
+        return false;
+    }
+
+    trace->records[head & (trace->capacity - 1)] = *record;
+    STORE_RELEASE(&trace->head, head + 1);
+    return true;
+}
+
+bool stusb4500_trace_pop(stusb4500_trace_t* trace, stusb4500_trace_record_t* record) {
+    uint32_t const tail = trace->tail;
+    uint32_t const head = LOAD_ACQUIRE(&trace->head);
+
+    if (head == tail) return false;
+
+    *record = trace->records[tail & (trace->capacity - 1)];
+    STORE_RELEASE(&trace->tail, tail + 1);
+    return true;
+}
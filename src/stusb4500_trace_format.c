@@ -0,0 +1,69 @@
+#include "stusb4500_trace.h"
+
+#include <stdio.h>
+
+int stusb4500_trace_format(stusb4500_trace_record_t const* record, char* buf, size_t size) {
+    stusb4500_src_pdo_t pdo;
+    uint32_t min_mv;
+    uint32_t max_mv;
+    uint32_t mv;
+    uint32_t ma;
+    uint32_t mw;
+
+    if (!record) return -1;
+
+    switch (record->event) {
+    case STUSB4500_TRACE_SRC_PDO:
+        if (!stusb4500_pdo_decode(record->value, &pdo))
+            return snprintf(buf, size, "Detected Source PDO: unsupported\r\n");
+
+        return snprintf(
+          buf,
+          size,
+          "Detected Source PDO: %2d.%03dV - %2d.%03dV, %d.%03dA, %3d.%03dW\r\n",
+          (int)(pdo.min_voltage_mv / 1000UL),
+          (int)(pdo.min_voltage_mv % 1000UL),
+          (int)(pdo.max_voltage_mv / 1000UL),
+          (int)(pdo.max_voltage_mv % 1000UL),
+          (int)(pdo.max_current_ma / 1000UL),
+          (int)(pdo.max_current_ma % 1000UL),
+          (int)(pdo.max_power_mw / 1000UL),
+          (int)(pdo.max_power_mw % 1000UL));
+
+    case STUSB4500_TRACE_CONSTRAINTS:
+        min_mv = record->value & 0xFFFFUL;
+        max_mv = record->value >> 16;
+        return snprintf(
+          buf,
+          size,
+          "\r\nSelecting optimal PDO based on user parameters: %d.%03dV - %d.%03dV, >= "
+          "%d.%03dA\r\n",
+          (int)(min_mv / 1000UL),
+          (int)(min_mv % 1000UL),
+          (int)(max_mv / 1000UL),
+          (int)(max_mv % 1000UL),
+          (int)(record->aux / 1000UL),
+          (int)(record->aux % 1000UL));
+
+    case STUSB4500_TRACE_SELECTED:
+        mv = record->value & 0xFFFFUL;
+        ma = record->value >> 16;
+        mw = mv * ma / 1000UL;
+        return snprintf(
+          buf,
+          size,
+          "Selected PDO: %d.%03dV, %d.%03dA, %d.%03dW\r\n\r\n",
+          (int)(mv / 1000UL),
+          (int)(mv % 1000UL),
+          (int)(ma / 1000UL),
+          (int)(ma % 1000UL),
+          (int)(mw / 1000UL),
+          (int)(mw % 1000UL));
+
+    case STUSB4500_TRACE_NO_PDO:
+        return snprintf(buf, size, "No suitable PDO found\r\n\r\n");
+
+    default:
+        return snprintf(buf, size, "Unknown trace event %d\r\n", (int)record->event);
+    }
+}
@@ -0,0 +1,162 @@
+// Runs the C++ layer against the simulator, with a bus policy that combines accesses into
+// transfers and with one that does not, and checks that failed FTP steps lock the NVM again.
+
+#include "stusb4500.hpp"
+
+extern "C" {
+#include "stusb4500_sim.h"
+}
+
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// Bus policy without transfer, every access is its own bus transaction
+class PlainBus {
+public:
+    explicit PlainBus(stusb4500_t const& dev) : bus_(dev) {}
+
+    bool read(uint8_t reg, void* buf, size_t len) {
+        return bus_.read(reg, buf, len);
+    }
+
+    bool write(uint8_t reg, void const* buf, size_t len) {
+        return bus_.write(reg, buf, len);
+    }
+
+    void delay_us(uint32_t us) {
+        bus_.delay_us(us);
+    }
+
+private:
+    stusb4500::CBus bus_;
+};
+
+static_assert(stusb4500::detail::has_transfer<stusb4500::CBus>::value);
+static_assert(!stusb4500::detail::has_transfer<PlainBus>::value);
+
+// Fails every access after a budget of successful ones. The transfer locking the NVM again and
+// the writes of a policy without transfer are exempt, so a failure always hits a step inside the
+// FTP session rather than the lock itself
+class FailingCBus : public stusb4500::CBus {
+public:
+    FailingCBus(stusb4500_t const& dev, int budget) : CBus(dev), budget_(budget) {}
+
+    bool read(uint8_t reg, void* buf, size_t len) {
+        return spend() && CBus::read(reg, buf, len);
+    }
+
+    bool transfer(stusb4500_msg_t const* msgs, size_t num_msgs) {
+        bool const lock = msgs[num_msgs - 1].reg == stusb4500::reg::FTP_CUST_PASSWORD;
+
+        return (lock || spend()) && CBus::transfer(msgs, num_msgs);
+    }
+
+private:
+    bool spend() {
+        return budget_-- > 0;
+    }
+
+    int budget_;
+};
+
+class FailingPlainBus : public PlainBus {
+public:
+    FailingPlainBus(stusb4500_t const& dev, int budget) : PlainBus(dev), budget_(budget) {}
+
+    bool read(uint8_t reg, void* buf, size_t len) {
+        return budget_-- > 0 && PlainBus::read(reg, buf, len);
+    }
+
+private:
+    int budget_;
+};
+
+stusb4500_sim_t sim;
+
+bool check(bool ok, char const* what) {
+    std::printf("%-44s %s\n", what, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+// A command still in execution keeps its request bit in FTP_CTRL_0, the password must be cleared
+bool locked() {
+    return sim.regs[stusb4500::reg::FTP_CUST_PASSWORD] == 0;
+}
+
+// Read, modify one field, write and read back through the C driver
+template <class Bus> bool nvm_round_trip(Bus& bus, stusb4500_t const& dev, uint16_t value) {
+    stusb4500::Device device(bus);
+    stusb4500::nvm_t nvm;
+    uint8_t readback[STUSB4500_NVM_SIZE];
+    uint16_t field;
+
+    if (!device.nvm_read(nvm)) return false;
+    if (!stusb4500::nvm_set(nvm, stusb4500::nvm_field<STUSB4500_NVM_V_SNK_PDO2>, value))
+        return false;
+    if (!device.nvm_write(nvm) || !locked()) return false;
+
+    if (!stusb4500_nvm_read(&dev, readback) || std::memcmp(readback, nvm, sizeof(nvm)) != 0)
+        return false;
+    return device.template nvm_read_field<STUSB4500_NVM_V_SNK_PDO2>(field) && field == value;
+}
+
+// Run a write with every budget up to a successful one. Returns false if any failed write left
+// the NVM unlocked
+template <class FailingBus> bool failed_writes_lock(stusb4500_t const& dev, uint16_t value) {
+    stusb4500::nvm_t nvm;
+    int failures = 0;
+
+    {
+        stusb4500::CBus bus(dev);
+        if (!stusb4500::Device(bus).nvm_read(nvm)) return false;
+    }
+
+    for (int budget = 0;; budget++) {
+        FailingBus bus(dev, budget);
+        stusb4500::Device device(bus);
+
+        stusb4500::nvm_set(nvm, stusb4500::nvm_field<STUSB4500_NVM_V_SNK_PDO2>, value++);
+        bool const ok = device.nvm_write(nvm);
+        if (!locked()) return false;
+        if (ok) break;
+        failures++;
+    }
+
+    return failures > 0;
+}
+
+} // namespace
+
+int main() {
+    stusb4500_sim_config_t sim_config;
+    stusb4500_t dev;
+    uint32_t transactions;
+    uint32_t plain_transactions;
+    bool pass = true;
+
+    stusb4500_sim_default_config(&sim_config);
+    stusb4500_sim_init(&sim, &sim_config);
+    stusb4500_sim_bind(&sim, &dev);
+
+    stusb4500::CBus cbus(dev);
+    PlainBus plain(dev);
+
+    transactions = sim.stats.transactions;
+    pass &= check(nvm_round_trip(cbus, dev, 180), "nvm round trip with transfer");
+    transactions = sim.stats.transactions - transactions;
+
+    plain_transactions = sim.stats.transactions;
+    pass &= check(nvm_round_trip(plain, dev, 240), "nvm round trip without transfer");
+    plain_transactions = sim.stats.transactions - plain_transactions;
+
+    pass &= check(transactions < plain_transactions, "transfers combine accesses");
+
+    pass &= check(
+      failed_writes_lock<FailingCBus>(dev, 100), "failed write steps lock with transfer");
+    pass &= check(
+      failed_writes_lock<FailingPlainBus>(dev, 300), "failed write steps lock without transfer");
+
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+// Runs the Linux backend against the simulator through a mocked ioctl, which checks the I2C_RDWR
+// messages and forwards each ioctl to the simulator as one transfer.
+
+#include "stusb4500_linux.h"
+#include "stusb4500_sim.h"
+
+#include <linux/i2c-dev.h>
+#include <linux/i2c.h>
+#include <stdio.h>
+
+#define FD 7
+#define ADDR 0x28
+
+static stusb4500_sim_t sim;
+static uint32_t ioctls;
+
+static int mock_ioctl(int fd, unsigned long request, void* arg) {
+    struct i2c_rdwr_ioctl_data const* rdwr = (struct i2c_rdwr_ioctl_data const*)arg;
+    stusb4500_msg_t msgs[STUSB4500_LINUX_MAX_MSGS];
+    size_t num_msgs = 0;
+
+    if (fd != FD || request != I2C_RDWR || rdwr->nmsgs > STUSB4500_LINUX_MAX_MSGS) return -1;
+
+    // A register address write, followed by a read or by the data to write
+    for (uint32_t i = 0; i < rdwr->nmsgs; i++) {
+        struct i2c_msg const* msg = &rdwr->msgs[i];
+        struct i2c_msg const* next = (i + 1 < rdwr->nmsgs) ? &rdwr->msgs[i + 1] : NULL;
+
+        if (msg->addr != ADDR || (msg->flags & I2C_M_RD) || !msg->len) return -1;
+
+        if (next && (next->flags & I2C_M_RD)) {
+            if (msg->len != 1 || next->addr != ADDR) return -1;
+            msgs[num_msgs++] =
+              (stusb4500_msg_t){msg->buf[0], STUSB4500_MSG_READ, next->buf, next->len};
+            i++;
+        } else {
+            msgs[num_msgs++] =
+              (stusb4500_msg_t){msg->buf[0], STUSB4500_MSG_WRITE, &msg->buf[1], msg->len - 1U};
+        }
+    }
+
+    ioctls++;
+    return stusb4500_sim_transfer(ADDR, msgs, num_msgs, &sim) ? (int)rdwr->nmsgs : -1;
+}
+
+// The simulator is the time base, see stusb4500_sim_bind()
+static void mock_delay(uint32_t us, void* context) {
+    (void)context;
+    stusb4500_sim_delay(us, &sim);
+}
+
+static bool check(bool ok, char const* what) {
+    printf("%-44s %s\n", what, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+int main(void) {
+    stusb4500_sim_config_t sim_config;
+    stusb4500_linux_bus_t bus;
+    stusb4500_t dev;
+    uint8_t nvm[STUSB4500_NVM_SIZE];
+    uint8_t buf[4];
+    stusb4500_msg_t msgs[STUSB4500_LINUX_MAX_MSGS / 2 + 1];
+    uint32_t transactions;
+    bool pass = true;
+
+    stusb4500_config_t const config = {
+      .min_current_ma = 1000,
+      .min_voltage_mv = 5000,
+      .max_voltage_mv = 20000,
+      .get_ms = stusb4500_sim_get_ms,
+    };
+    stusb4500_nvm_config_t const nvm_config = {
+      .pdo1_current_ma = 1500,
+      .pdo2_voltage_mv = 9000,
+      .pdo2_current_ma = 2000,
+      .pdo3_voltage_mv = 12000,
+      .pdo3_current_ma = 1500,
+      .pdo_current_fallback = 1000,
+      .num_valid_pdos = 3,
+      .use_src_current = false,
+      .only_above_5v = true,
+      .gpio_cfg = STUSB4500_GPIO_CFG_SW_CTRL,
+    };
+
+    stusb4500_sim_default_config(&sim_config);
+    stusb4500_sim_init(&sim, &sim_config);
+
+    bus.fd = FD;
+    bus.ioctl = mock_ioctl;
+    bus.ioctls = 0;
+    stusb4500_linux_bind(&bus, &dev, ADDR);
+    dev.delay = mock_delay;
+
+    // Every transfer of the library is one ioctl, and so one transaction of the simulator
+    transactions = sim.stats.transactions;
+    pass &= check(stusb4500_negotiate(&dev, &config, false), "negotiate");
+    pass &= check(stusb4500_nvm_flash(&dev, &nvm_config), "nvm_flash");
+    pass &= check(stusb4500_nvm_read(&dev, nvm), "nvm_read");
+    pass &= check(
+      ioctls == bus.ioctls && sim.stats.transactions - transactions == ioctls,
+      "one ioctl per transfer");
+
+    // Too many messages for one ioctl
+    for (size_t i = 0; i < sizeof(msgs) / sizeof(msgs[0]); i++) {
+        msgs[i] = (stusb4500_msg_t){0x85, STUSB4500_MSG_READ, buf, sizeof(buf)};
+    }
+    transactions = bus.ioctls;
+    pass &= check(
+      !stusb4500_linux_transfer(ADDR, msgs, sizeof(msgs) / sizeof(msgs[0]), &bus) &&
+        bus.ioctls == transactions,
+      "oversized transfer fails without an ioctl");
+    pass &= check(
+      stusb4500_linux_transfer(ADDR, msgs, sizeof(msgs) / sizeof(msgs[0]) - 1, &bus) &&
+        bus.ioctls == transactions + 1,
+      "largest transfer is one ioctl");
+
+    return pass ? 0 : 1;
+}
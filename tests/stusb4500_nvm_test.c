@@ -0,0 +1,160 @@
+// Checks the serialized NVM image codec against a factory NVM dump, and flashes images to the
+// simulator.
+
+#include "stusb4500.h"
+#include "stusb4500_defs.h"
+#include "stusb4500_sim.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Factory NVM content of the STUSB4500
+static uint8_t const factory_nvm[STUSB4500_NVM_SIZE] = {
+  0x00, 0x00, 0xB0, 0xAA, 0x00, 0x45, 0x00, 0x00, // sector 0
+  0x10, 0x40, 0x9C, 0x1C, 0xFF, 0x01, 0x3C, 0xDF, // sector 1
+  0x02, 0x40, 0x0F, 0x00, 0x32, 0x00, 0xFC, 0xF1, // sector 2
+  0x00, 0x19, 0x56, 0xAF, 0xF5, 0x35, 0x5F, 0x00, // sector 3
+  0x00, 0x4B, 0x90, 0x21, 0x43, 0x00, 0x40, 0xFB, // sector 4
+};
+
+// CRC-16/CCITT-FALSE of the magic, the version and factory_nvm
+#define FACTORY_IMAGE_CRC 0x2DD2U
+
+// Sectors 0 and 2 hold factory trimming, no field of the library is located there
+#define FACTORY_SECTORS (STUSB4500_NVM_SECTOR(0) | STUSB4500_NVM_SECTOR(2))
+
+static stusb4500_sim_t sim;
+
+// Reference CRC-16/CCITT-FALSE: poly 0x1021, init 0xFFFF, no reflection, no final xor
+static uint16_t crc16(uint8_t const* data, size_t len) {
+    uint16_t crc = 0xFFFF;
+
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)(data[i] << 8);
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000U) ? (uint16_t)((crc << 1) ^ 0x1021U) : (uint16_t)(crc << 1);
+        }
+    }
+
+    return crc;
+}
+
+// Recompute the CRC of a modified image, so only its header checks can reject it
+static void seal(uint8_t* image) {
+    uint16_t const crc = crc16(image, STUSB4500_NVM_IMAGE_SIZE - 2);
+
+    image[STUSB4500_NVM_IMAGE_SIZE - 2] = (uint8_t)crc;
+    image[STUSB4500_NVM_IMAGE_SIZE - 1] = (uint8_t)(crc >> 8);
+}
+
+static bool check(bool ok, char const* what) {
+    printf("%-44s %s\n", what, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+static bool field_is(uint8_t const* nvm, stusb4500_nvm_field_t field, uint16_t expected) {
+    uint16_t value;
+
+    return stusb4500_nvm_get(nvm, field, &value) && value == expected;
+}
+
+static bool sectors_match(uint8_t const* a, uint8_t const* b, uint8_t sectors) {
+    for (uint8_t sector = 0; sector < STUSB4500_NVM_NUM_SECTORS; sector++) {
+        size_t const offset = sector * STUSB4500_NVM_SECTOR_SIZE;
+
+        if (
+          (sectors & STUSB4500_NVM_SECTOR(sector)) &&
+          memcmp(&a[offset], &b[offset], STUSB4500_NVM_SECTOR_SIZE) != 0)
+            return false;
+    }
+    return true;
+}
+
+int main(void) {
+    stusb4500_sim_config_t sim_config;
+    stusb4500_t dev;
+    uint8_t image[STUSB4500_NVM_IMAGE_SIZE];
+    uint8_t repacked[STUSB4500_NVM_IMAGE_SIZE];
+    uint8_t corrupt[STUSB4500_NVM_IMAGE_SIZE];
+    uint8_t nvm[STUSB4500_NVM_SIZE];
+    uint32_t transactions;
+    bool pass = true;
+
+    pass &= check(
+      crc16((uint8_t const*)"123456789", 9) == 0x29B1, "CRC-16/CCITT-FALSE check value");
+
+    // Encode
+    pass &= check(stusb4500_nvm_image_pack(factory_nvm, image), "pack");
+    pass &= check(
+      image[0] == (uint8_t)STUSB4500_NVM_IMAGE_MAGIC &&
+        image[1] == (uint8_t)(STUSB4500_NVM_IMAGE_MAGIC >> 8) &&
+        image[2] == STUSB4500_NVM_IMAGE_VERSION &&
+        memcmp(&image[3], factory_nvm, STUSB4500_NVM_SIZE) == 0,
+      "pack header and content");
+    pass &= check(
+      image[STUSB4500_NVM_IMAGE_SIZE - 2] == (uint8_t)FACTORY_IMAGE_CRC &&
+        image[STUSB4500_NVM_IMAGE_SIZE - 1] == (uint8_t)(FACTORY_IMAGE_CRC >> 8),
+      "pack CRC-16/CCITT-FALSE golden vector");
+
+    // Decode, then encode again
+    memset(nvm, 0, sizeof(nvm));
+    pass &= check(stusb4500_nvm_image_unpack(image, nvm), "unpack");
+    pass &= check(memcmp(nvm, factory_nvm, sizeof(nvm)) == 0, "unpack content");
+    pass &= check(
+      stusb4500_nvm_image_pack(nvm, repacked) && memcmp(repacked, image, sizeof(image)) == 0,
+      "unpack and pack round trip");
+    pass &= check(
+      field_is(nvm, STUSB4500_NVM_SNK_PDO_NUMB, 3) &&
+        field_is(nvm, STUSB4500_NVM_I_SNK_PDO1, 5) &&
+        field_is(nvm, STUSB4500_NVM_V_SNK_PDO2, 300) &&
+        field_is(nvm, STUSB4500_NVM_V_SNK_PDO3, 400),
+      "factory fields");
+
+    // Any flipped bit of the content or the CRC is rejected
+    bool rejected = true;
+    for (size_t i = 3; i < sizeof(image); i++) {
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            memcpy(corrupt, image, sizeof(image));
+            corrupt[i] ^= (uint8_t)(1U << bit);
+            if (stusb4500_nvm_image_unpack(corrupt, nvm)) rejected = false;
+        }
+    }
+    pass &= check(rejected, "unpack rejects corrupted images");
+
+    memcpy(corrupt, image, sizeof(image));
+    corrupt[0] ^= 0xFF;
+    seal(corrupt);
+    pass &= check(!stusb4500_nvm_image_unpack(corrupt, nvm), "unpack rejects a bad magic");
+
+    memcpy(corrupt, image, sizeof(image));
+    corrupt[2] = STUSB4500_NVM_IMAGE_VERSION + 1;
+    seal(corrupt);
+    pass &= check(!stusb4500_nvm_image_unpack(corrupt, nvm), "unpack rejects a bad version");
+
+    // Flash an image of the factory NVM with a changed field
+    stusb4500_sim_default_config(&sim_config);
+    stusb4500_sim_init(&sim, &sim_config);
+    stusb4500_sim_bind(&sim, &dev);
+
+    memcpy(nvm, factory_nvm, sizeof(nvm));
+    stusb4500_nvm_set(nvm, STUSB4500_NVM_V_SNK_PDO2, 180);
+    stusb4500_nvm_image_pack(nvm, image);
+
+    memcpy(corrupt, image, sizeof(image));
+    corrupt[3] ^= 0x01;
+    transactions = sim.stats.transactions;
+    pass &= check(
+      !stusb4500_nvm_flash_image(&dev, corrupt) && sim.stats.transactions == transactions,
+      "flash_image rejects an invalid image");
+
+    pass &= check(stusb4500_nvm_flash_image(&dev, image), "flash_image");
+    pass &= check(sectors_match(sim.nvm, nvm, STUSB4500_NVM_ALL_SECTORS), "flash_image content");
+    pass &= check(
+      sectors_match(sim.nvm, factory_nvm, FACTORY_SECTORS), "flash_image keeps factory sectors");
+    pass &= check(
+      sim.regs[STUSB4500_FTP_CUST_PASSWORD_REG] == 0 && stusb4500_nvm_read(&dev, nvm) &&
+        field_is(nvm, STUSB4500_NVM_V_SNK_PDO2, 180),
+      "flash_image locks and reads back");
+
+    return pass ? 0 : 1;
+}
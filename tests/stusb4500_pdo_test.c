@@ -0,0 +1,245 @@
+// Table-driven checks of the PDO selection: the ranking of source capabilities, the sink PDOs
+// computed from them and the object position the STUSB4500 requests once they are loaded, run
+// through a negotiation against the simulator.
+
+#include "stusb4500.h"
+#include "stusb4500_regs.h"
+#include "stusb4500_sim.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Source PDOs, see USB PD spec Section 6.4.1
+#define FIXED(mv, ma) STUSB4500_SIM_FIXED_PDO(mv, ma)
+#define VARIABLE(min_mv, max_mv, ma)                                                               \
+    ((0x02UL << 30) | (((max_mv) / 50UL) << 20) | (((min_mv) / 50UL) << 10) | ((ma) / 10UL))
+#define BATTERY(min_mv, max_mv, mw)                                                                \
+    ((0x01UL << 30) | (((max_mv) / 50UL) << 20) | (((min_mv) / 50UL) << 10) | ((mw) / 250UL))
+#define PPS(min_mv, max_mv, ma)                                                                    \
+    ((0x03UL << 30) | (((max_mv) / 100UL) << 17) | (((min_mv) / 100UL) << 8) | ((ma) / 50UL))
+
+// Sink PDOs have the layout of fixed source PDOs
+#define SNK(mv, ma) FIXED(mv, ma)
+
+typedef struct {
+    char const* name;
+    uint32_t src_pdos[STUSB4500_MAX_SRC_PDOS];
+    uint8_t num_src_pdos;
+    stusb4500_current_t min_current_ma;
+    stusb4500_voltage_t min_voltage_mv;
+    stusb4500_voltage_t max_voltage_mv;
+
+    // Object positions of the candidates, best first
+    uint8_t ranked[STUSB4500_MAX_SRC_PDOS];
+    uint8_t num_ranked;
+    uint32_t snk_pdos[STUSB4500_NUM_SNK_PDOS];
+    uint8_t num_snk_pdos;
+    // Object position of the contract, 0 if the negotiation must fail
+    uint8_t rdo_position;
+} pdo_case_t;
+
+static pdo_case_t const cases[] = {
+  {
+    .name = "fixed, equal power keeps source order",
+    .src_pdos = {FIXED(5000, 3000), FIXED(9000, 3000), FIXED(15000, 3000), FIXED(20000, 2250)},
+    .num_src_pdos = 4,
+    .min_current_ma = 1000,
+    .min_voltage_mv = 5000,
+    .max_voltage_mv = 20000,
+    .ranked = {3, 4, 2, 1},
+    .num_ranked = 4,
+    .snk_pdos = {SNK(5000, 3000), SNK(9000, 3000), SNK(15000, 3000)},
+    .num_snk_pdos = 3,
+    .rdo_position = 3,
+  },
+  {
+    .name = "fixed, fallback below the optimum",
+    .src_pdos = {FIXED(5000, 3000), FIXED(9000, 3000), FIXED(12000, 3000), FIXED(20000, 3000)},
+    .num_src_pdos = 4,
+    .min_current_ma = 1000,
+    .min_voltage_mv = 5000,
+    .max_voltage_mv = 20000,
+    .ranked = {4, 3, 2, 1},
+    .num_ranked = 4,
+    .snk_pdos = {SNK(5000, 3000), SNK(12000, 3000), SNK(20000, 3000)},
+    .num_snk_pdos = 3,
+    .rdo_position = 4,
+  },
+  {
+    .name = "fixed, maximum voltage",
+    .src_pdos = {FIXED(5000, 3000), FIXED(9000, 3000), FIXED(15000, 3000), FIXED(20000, 2250)},
+    .num_src_pdos = 4,
+    .min_current_ma = 1000,
+    .min_voltage_mv = 5000,
+    .max_voltage_mv = 12000,
+    .ranked = {2, 1},
+    .num_ranked = 2,
+    .snk_pdos = {SNK(5000, 3000), SNK(9000, 3000)},
+    .num_snk_pdos = 2,
+    .rdo_position = 2,
+  },
+  {
+    .name = "fixed, minimum current leaves 5V",
+    .src_pdos = {FIXED(5000, 3000), FIXED(9000, 2000), FIXED(12000, 1500)},
+    .num_src_pdos = 3,
+    .min_current_ma = 2500,
+    .min_voltage_mv = 5000,
+    .max_voltage_mv = 20000,
+    .ranked = {1},
+    .num_ranked = 1,
+    .snk_pdos = {SNK(5000, 3000)},
+    .num_snk_pdos = 1,
+    .rdo_position = 1,
+  },
+  {
+    .name = "variable, ranked but not requestable",
+    .src_pdos = {FIXED(5000, 3000), FIXED(9000, 3000), VARIABLE(5000, 20000, 3000)},
+    .num_src_pdos = 3,
+    .min_current_ma = 1000,
+    .min_voltage_mv = 5000,
+    .max_voltage_mv = 20000,
+    .ranked = {3, 2, 1},
+    .num_ranked = 3,
+    .snk_pdos = {SNK(5000, 3000), SNK(9000, 3000)},
+    .num_snk_pdos = 2,
+    .rdo_position = 2,
+  },
+  {
+    .name = "battery, current from power at max voltage",
+    .src_pdos = {FIXED(5000, 3000), FIXED(12000, 1500), BATTERY(5000, 21000, 60000)},
+    .num_src_pdos = 3,
+    .min_current_ma = 1000,
+    .min_voltage_mv = 5000,
+    .max_voltage_mv = 20000,
+    .ranked = {3, 2, 1},
+    .num_ranked = 3,
+    .snk_pdos = {SNK(5000, 3000), SNK(12000, 1500)},
+    .num_snk_pdos = 2,
+    .rdo_position = 2,
+  },
+  {
+    .name = "battery, below minimum current",
+    .src_pdos = {FIXED(5000, 3000), FIXED(9000, 2000), BATTERY(9000, 20000, 15000)},
+    .num_src_pdos = 3,
+    .min_current_ma = 1000,
+    .min_voltage_mv = 5000,
+    .max_voltage_mv = 20000,
+    .ranked = {2, 1},
+    .num_ranked = 2,
+    .snk_pdos = {SNK(5000, 3000), SNK(9000, 2000)},
+    .num_snk_pdos = 2,
+    .rdo_position = 2,
+  },
+  {
+    .name = "PPS, decoded with USBPD_REV30_SUPPORT only",
+    .src_pdos = {FIXED(5000, 3000), FIXED(9000, 3000), PPS(3300, 21000, 3000)},
+    .num_src_pdos = 3,
+    .min_current_ma = 1000,
+    .min_voltage_mv = 5000,
+    .max_voltage_mv = 20000,
+#ifdef USBPD_REV30_SUPPORT
+    .ranked = {3, 2, 1},
+    .num_ranked = 3,
+#else  // USBPD_REV30_SUPPORT
+    .ranked = {2, 1},
+    .num_ranked = 2,
+#endif // USBPD_REV30_SUPPORT
+    .snk_pdos = {SNK(5000, 3000), SNK(9000, 3000)},
+    .num_snk_pdos = 2,
+    .rdo_position = 2,
+  },
+  {
+    .name = "no requestable supply",
+    .src_pdos = {FIXED(5000, 3000), VARIABLE(5000, 12000, 3000)},
+    .num_src_pdos = 2,
+    .min_current_ma = 1000,
+    .min_voltage_mv = 9000,
+    .max_voltage_mv = 20000,
+    .ranked = {2},
+    .num_ranked = 1,
+    .num_snk_pdos = 0,
+    .rdo_position = 0,
+  },
+};
+
+static bool check(bool ok, char const* what) {
+    printf("%-44s %s\n", what, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+static bool ranking_matches(pdo_case_t const* c, stusb4500_config_t const* config) {
+    stusb4500_candidate_t candidates[STUSB4500_MAX_SRC_PDOS];
+    uint8_t const num_candidates = stusb4500_pdo_rank(
+      config, c->src_pdos, c->num_src_pdos, candidates, STUSB4500_MAX_SRC_PDOS);
+
+    if (num_candidates != c->num_ranked) return false;
+
+    for (uint8_t i = 0; i < num_candidates; i++) {
+        if (candidates[i].position != c->ranked[i]) return false;
+    }
+    return true;
+}
+
+static bool snk_pdos_match(pdo_case_t const* c, stusb4500_config_t const* config) {
+    uint32_t snk_pdos[STUSB4500_NUM_SNK_PDOS] = {0};
+    uint8_t const num_snk_pdos =
+      stusb4500_pdo_snk_set(config, c->src_pdos, c->num_src_pdos, snk_pdos);
+
+    return num_snk_pdos == c->num_snk_pdos &&
+           memcmp(snk_pdos, c->snk_pdos, num_snk_pdos * sizeof(uint32_t)) == 0;
+}
+
+// Negotiate with all sink PDOs loaded and read back what the STUSB4500 holds
+static bool contract_matches(pdo_case_t const* c, stusb4500_config_t const* config) {
+    stusb4500_sim_config_t sim_config;
+    stusb4500_sim_t sim;
+    stusb4500_t dev;
+    stusb4500_regs_t regs;
+
+    stusb4500_sim_default_config(&sim_config);
+    memcpy(sim_config.src_pdos, c->src_pdos, sizeof(c->src_pdos));
+    sim_config.num_src_pdos = c->num_src_pdos;
+    stusb4500_sim_init(&sim, &sim_config);
+    stusb4500_sim_bind(&sim, &dev);
+
+    if (!c->rdo_position) return !stusb4500_negotiate(&dev, config, false);
+
+    if (!stusb4500_negotiate(&dev, config, false)) return false;
+
+    // The negotiation ends with the soft reset, let the source answer it
+    stusb4500_sim_delay(
+      sim_config.soft_reset_accept_us + sim_config.caps_delay_us + sim_config.accept_delay_us +
+        sim_config.ready_delay_us,
+      &sim);
+    if (!stusb4500_regs_read(&dev, &regs)) return false;
+
+    if (stusb4500_regs_num_snk_pdos(&regs) != c->num_snk_pdos) return false;
+    for (uint8_t i = 0; i < c->num_snk_pdos; i++) {
+        if (stusb4500_regs_snk_pdo(&regs, i) != c->snk_pdos[i]) return false;
+    }
+    return stusb4500_regs_rdo_position(&regs) == c->rdo_position;
+}
+
+int main(void) {
+    char what[64];
+    bool pass = true;
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        pdo_case_t const* c = &cases[i];
+        stusb4500_config_t const config = {
+          .min_current_ma = c->min_current_ma,
+          .min_voltage_mv = c->min_voltage_mv,
+          .max_voltage_mv = c->max_voltage_mv,
+          .get_ms = stusb4500_sim_get_ms,
+          .load_all_pdos = true,
+        };
+
+        printf("%s\n", c->name);
+        pass &= check(ranking_matches(c, &config), "  ranking");
+        pass &= check(snk_pdos_match(c, &config), "  sink PDOs");
+        snprintf(what, sizeof(what), "  contract at position %u", c->rdo_position);
+        pass &= check(contract_matches(c, &config), what);
+    }
+
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,142 @@
+// Drives a negotiation and an NVM read and flash through the simulator, and checks the register
+// and NVM state the STUSB4500 is left with.
+
+#include "stusb4500.h"
+#include "stusb4500_defs.h"
+#include "stusb4500_regs.h"
+#include "stusb4500_sim.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Sectors 0 and 2 hold factory trimming, no field of the library is located there
+#define FACTORY_SECTORS (STUSB4500_NVM_SECTOR(0) | STUSB4500_NVM_SECTOR(2))
+
+static stusb4500_sim_t sim;
+
+static bool check(bool ok, char const* what) {
+    printf("%-44s %s\n", what, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+static bool field_is(uint8_t const* nvm, stusb4500_nvm_field_t field, uint16_t expected) {
+    uint16_t value;
+
+    return stusb4500_nvm_get(nvm, field, &value) && value == expected;
+}
+
+static bool sectors_match(uint8_t const* a, uint8_t const* b, uint8_t sectors) {
+    for (uint8_t sector = 0; sector < STUSB4500_NVM_NUM_SECTORS; sector++) {
+        size_t const offset = sector * STUSB4500_NVM_SECTOR_SIZE;
+
+        if (
+          (sectors & STUSB4500_NVM_SECTOR(sector)) &&
+          memcmp(&a[offset], &b[offset], STUSB4500_NVM_SECTOR_SIZE) != 0)
+            return false;
+    }
+    return true;
+}
+
+// The negotiation ends with the soft reset, let the source answer it
+static void settle(stusb4500_sim_config_t const* sim_config) {
+    stusb4500_sim_delay(
+      sim_config->soft_reset_accept_us + sim_config->caps_delay_us +
+        sim_config->accept_delay_us + sim_config->ready_delay_us,
+      &sim);
+}
+
+static bool contract_is(stusb4500_t const* dev, uint32_t snk_pdo3, uint8_t position) {
+    stusb4500_regs_t regs;
+
+    if (!stusb4500_regs_read(dev, &regs)) return false;
+
+    return stusb4500_regs_attached(&regs) &&
+           stusb4500_regs_pe_state(&regs) == STUSB4500_PE_SNK_READY &&
+           stusb4500_regs_num_snk_pdos(&regs) == 3 &&
+           stusb4500_regs_snk_pdo(&regs, 2) == snk_pdo3 &&
+           stusb4500_regs_rdo_position(&regs) == position;
+}
+
+int main(void) {
+    stusb4500_sim_config_t sim_config;
+    stusb4500_t dev;
+    uint8_t factory_nvm[STUSB4500_NVM_SIZE];
+    uint8_t nvm[STUSB4500_NVM_SIZE];
+    uint8_t expected[STUSB4500_NVM_SIZE];
+    uint32_t soft_resets;
+    bool pass = true;
+
+    stusb4500_config_t const config = {
+      .min_current_ma = 1000,
+      .min_voltage_mv = 5000,
+      .max_voltage_mv = 20000,
+      .get_ms = stusb4500_sim_get_ms,
+    };
+    stusb4500_nvm_config_t const nvm_config = {
+      .pdo1_current_ma = 1500,
+      .pdo2_voltage_mv = 9000,
+      .pdo2_current_ma = 2000,
+      .pdo3_voltage_mv = 12000,
+      .pdo3_current_ma = 1500,
+      .pdo_current_fallback = 1000,
+      .num_valid_pdos = 3,
+      .use_src_current = false,
+      .only_above_5v = true,
+      .gpio_cfg = STUSB4500_GPIO_CFG_SW_CTRL,
+    };
+
+    stusb4500_sim_default_config(&sim_config);
+    stusb4500_sim_init(&sim, &sim_config);
+    stusb4500_sim_bind(&sim, &dev);
+    memcpy(factory_nvm, sim.nvm, sizeof(factory_nvm));
+
+    // Powered up with the NVM defaults, 20V 1A is contracted from the 5V/9V/15V/20V source
+    pass &= check(
+      contract_is(&dev, STUSB4500_SIM_FIXED_PDO(20000, 1000), 4), "power up contract at 20V");
+
+    // 15V 3A and 20V 2.25A have equal power, the lower voltage is preferred. One soft reset asks
+    // for the source capabilities, another one renegotiates with the new PDO
+    soft_resets = sim.stats.soft_resets;
+    pass &= check(stusb4500_negotiate(&dev, &config, false), "negotiate");
+    pass &= check(sim.stats.soft_resets == soft_resets + 2, "negotiate renegotiates");
+    settle(&sim_config);
+    pass &= check(
+      contract_is(&dev, STUSB4500_SIM_FIXED_PDO(15000, 3000), 3), "negotiated contract at 15V");
+
+    // The contract is in place, negotiating again only asks for the source capabilities
+    soft_resets = sim.stats.soft_resets;
+    pass &= check(stusb4500_negotiate(&dev, &config, false), "negotiate again");
+    settle(&sim_config);
+    pass &= check(
+      sim.stats.soft_resets == soft_resets + 1 &&
+        contract_is(&dev, STUSB4500_SIM_FIXED_PDO(15000, 3000), 3),
+      "contract kept without renegotiation");
+
+    // Read
+    pass &= check(stusb4500_nvm_read(&dev, nvm), "nvm_read");
+    pass &= check(memcmp(nvm, factory_nvm, sizeof(nvm)) == 0, "nvm_read content");
+    pass &= check(sim.regs[STUSB4500_FTP_CUST_PASSWORD_REG] == 0, "nvm_read locks");
+
+    // Flash
+    memcpy(expected, factory_nvm, sizeof(expected));
+    stusb4500_nvm_apply_config(expected, &nvm_config);
+    pass &= check(stusb4500_nvm_flash(&dev, &nvm_config), "nvm_flash");
+    pass &= check(sim.regs[STUSB4500_FTP_CUST_PASSWORD_REG] == 0, "nvm_flash locks");
+    pass &= check(memcmp(sim.nvm, expected, sizeof(expected)) == 0, "nvm_flash content");
+    pass &= check(
+      field_is(sim.nvm, STUSB4500_NVM_SNK_PDO_NUMB, 3) &&
+        field_is(sim.nvm, STUSB4500_NVM_V_SNK_PDO2, 9000 / 50) &&
+        field_is(sim.nvm, STUSB4500_NVM_V_SNK_PDO3, 12000 / 50) &&
+        field_is(sim.nvm, STUSB4500_NVM_POWER_ONLY_ABOVE_5V, 1) &&
+        field_is(sim.nvm, STUSB4500_NVM_GPIO_CFG, STUSB4500_GPIO_CFG_SW_CTRL),
+      "nvm_flash fields");
+    pass &= check(
+      sectors_match(sim.nvm, factory_nvm, FACTORY_SECTORS) && sim.stats.sector_erases[0] == 0 &&
+        sim.stats.sector_erases[2] == 0,
+      "nvm_flash keeps factory sectors");
+    pass &= check(
+      stusb4500_nvm_read(&dev, nvm) && memcmp(nvm, expected, sizeof(nvm)) == 0,
+      "nvm_flash reads back");
+
+    return pass ? 0 : 1;
+}
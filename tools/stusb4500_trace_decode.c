@@ -0,0 +1,28 @@
+// Render a raw dump of stusb4500_trace_record_t as text
+// Usage: stusb4500_trace_decode [dump file], reads stdin if no file is given
+
+#include "stusb4500_trace.h"
+
+#include <stdio.h>
+
+int main(int argc, char** argv) {
+    FILE* in = stdin;
+    stusb4500_trace_record_t record;
+    char line[256];
+
+    if (argc > 1) {
+        in = fopen(argv[1], "rb");
+        if (!in) {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+
+    while (fread(&record, sizeof(record), 1, in) == 1) {
+        stusb4500_trace_format(&record, line, sizeof(line));
+        printf("[%10lu ms] %s", (unsigned long)record.timestamp_ms, line);
+    }
+
+    if (in != stdin) fclose(in);
+    return 0;
+}